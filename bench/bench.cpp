@@ -0,0 +1,492 @@
+#include "engine.hpp"
+#include "metrics.hpp"
+#include "worker.hpp"
+
+#include <cocaine/context.hpp>
+#include <cocaine/rpc.hpp>
+
+#include <cocaine/api/sandbox.hpp>
+
+#include <fstream>
+#include <iostream>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <cmath>
+#include <cstdlib>
+
+using namespace cocaine;
+using namespace cocaine::bench;
+using namespace cocaine::engine;
+using namespace cocaine::io;
+
+namespace fs = boost::filesystem;
+namespace po = boost::program_options;
+
+namespace {
+  // Replies to "echo" with a short chunk once the request is choked, sends
+  // every chunk sent to "mirror" right back, and silently swallows everything
+  // sent to any other event.
+  struct downstream_t:
+    public api::stream_t
+  {
+    downstream_t(const boost::shared_ptr<api::stream_t>& upstream,
+                 bool echo,
+                 bool mirror):
+      m_upstream(upstream),
+      m_echo(echo),
+      m_mirror(mirror)
+    { }
+
+    virtual
+    void
+    push(const char * chunk,
+         size_t size)
+    {
+      if(m_mirror) {
+        m_upstream->push(chunk, size);
+      }
+    }
+
+    virtual
+    void
+    error(error_code,
+          const std::string&)
+    { }
+
+    virtual
+    void
+    close() {
+      if(m_echo) {
+        m_upstream->push("ok", 2);
+      }
+
+      m_upstream->close();
+    }
+
+  private:
+    const boost::shared_ptr<api::stream_t> m_upstream;
+    const bool m_echo,
+               m_mirror;
+  };
+
+  struct sandbox_t:
+    public api::sandbox_t
+  {
+    virtual
+    boost::shared_ptr<api::stream_t>
+    invoke(const std::string& event,
+           const boost::shared_ptr<api::stream_t>& upstream)
+    {
+      return boost::make_shared<downstream_t>(upstream, event == "echo", event == "mirror");
+    }
+  };
+
+  std::unique_ptr<api::sandbox_t>
+  make_sandbox() {
+    return std::unique_ptr<api::sandbox_t>(new sandbox_t());
+  }
+
+  void
+  write(const fs::path& path,
+        const Json::Value& value)
+  {
+    fs::create_directories(path.parent_path());
+
+    std::ofstream stream(path.string().c_str());
+
+    stream << Json::StyledWriter().write(value);
+  }
+
+  // A scratch runtime with a configuration, a manifest and a profile for the
+  // app under test, removed once the benchmark is done.
+  struct fixture_t {
+    explicit
+    fixture_t(size_t shm_threshold):
+      root(fs::temp_directory_path() / fs::unique_path("cocaine-bench-%%%%%%%%"))
+    {
+      Json::Value config(Json::objectValue);
+
+      config["version"] = 2;
+      config["paths"]["plugins"] = "/usr/lib/cocaine";
+      config["paths"]["runtime"] = (root / "run").string();
+      config["paths"]["spool"] = (root / "spool").string();
+      config["storages"]["core"]["type"] = "files";
+      config["storages"]["core"]["args"]["path"] = (root / "storage").string();
+      config["loggers"]["core"]["type"] = "stdout";
+      config["loggers"]["core"]["args"]["verbosity"] = "warning";
+
+      write(root / "cocaine.conf", config);
+
+      Json::Value manifest(Json::objectValue);
+
+      manifest["type"] = "bench";
+      manifest["slave"] = "/bin/true";
+
+      write(root / "storage" / "manifests" / "bench", manifest);
+
+      Json::Value profile(Json::objectValue);
+
+      // NOTE: The fake engine doesn't send heartbeats while measuring.
+      profile["heartbeat-timeout"] = 3600;
+      profile["heartbeat-interval"] = 0.5;
+      profile["heartbeat-load"] = true;
+
+      if(shm_threshold) {
+        profile["shm-threshold"] = static_cast<Json::UInt>(shm_threshold);
+      }
+
+      write(root / "storage" / "profiles" / "bench", profile);
+
+      fs::create_directories(root / "run" / "engines");
+      fs::create_directories(root / "spool" / "bench");
+    }
+
+    ~fixture_t() {
+      boost::system::error_code code;
+      fs::remove_all(root, code);
+    }
+
+    std::string
+    endpoint() const {
+      return "ipc://" + (root / "run" / "engines" / "bench").string();
+    }
+
+    const fs::path root;
+  };
+
+  typedef std::map<std::string, double> results_t;
+
+  class runner_t {
+  public:
+    runner_t(engine_t& engine):
+      m_engine(engine)
+    { }
+
+    // Keeps up to the given number of echo requests in flight.
+    double
+    invoke_throughput(size_t requests,
+                      size_t window)
+    {
+      const clock_type::time_point started = clock_type::now();
+
+      size_t sent = 0,
+             done = 0;
+
+      while(done < requests) {
+        while(sent < requests && sent - done < window) {
+          const unique_id_t session;
+
+          m_engine.invoke(session, "echo");
+          m_engine.choke(session);
+
+          ++sent;
+        }
+
+        if(next().type == event_traits<rpc::choke>::id) {
+          ++done;
+        }
+      }
+
+      return requests / seconds(clock_type::now() - started);
+    }
+
+    // Streams the given amount of bytes through a single session.
+    double
+    chunk_throughput(size_t size,
+                     size_t total)
+    {
+      const std::string chunk(size, 'x');
+      const unique_id_t session;
+
+      const clock_type::time_point started = clock_type::now();
+
+      m_engine.invoke(session, "sink");
+
+      for(size_t sent = 0; sent < total; sent += size) {
+        m_engine.chunk(session, chunk);
+      }
+
+      m_engine.choke(session);
+
+      while(next().type != event_traits<rpc::choke>::id) {
+        // Empty.
+      }
+
+      return total / seconds(clock_type::now() - started);
+    }
+
+    // Streams the given amount of bytes through a single session and back,
+    // checking that every chunk has made it.
+    double
+    mirror_throughput(size_t size,
+                      size_t total)
+    {
+      const std::string chunk(size, 'x');
+      const unique_id_t session;
+
+      const clock_type::time_point started = clock_type::now();
+
+      m_engine.invoke(session, "mirror");
+
+      size_t sent = 0;
+
+      for(size_t bytes = 0; bytes < total; bytes += size) {
+        m_engine.chunk(session, chunk);
+        ++sent;
+      }
+
+      m_engine.choke(session);
+
+      size_t received = 0;
+
+      while(true) {
+        const message_t message(next());
+
+        if(message.type == event_traits<rpc::choke>::id) {
+          break;
+        }
+
+        if(message.type == event_traits<rpc::chunk>::id) {
+          if(message.data != chunk) {
+            throw cocaine::error_t("the worker has mangled a chunk of %d bytes", size);
+          }
+
+          ++received;
+        }
+      }
+
+      if(received != sent) {
+        throw cocaine::error_t("the worker has sent back %d chunks out of %d", received, sent);
+      }
+
+      return total / seconds(clock_type::now() - started);
+    }
+
+    // Sequential requests, timed from the invoke till the reply choke.
+    void
+    choke_latency(size_t requests,
+                  histogram_t& histogram)
+    {
+      for(size_t i = 0; i < requests; ++i) {
+        const unique_id_t session;
+        const clock_type::time_point started = clock_type::now();
+
+        m_engine.invoke(session, "echo");
+        m_engine.choke(session);
+
+        while(next().type != event_traits<rpc::choke>::id) {
+          // Empty.
+        }
+
+        histogram.record(microseconds(clock_type::now() - started));
+      }
+    }
+
+  private:
+    message_t
+    next() {
+      message_t message;
+
+      if(!m_engine.recv(message, 5000)) {
+        throw cocaine::error_t("the worker is not responding");
+      }
+
+      return message;
+    }
+
+    static
+    double
+    seconds(clock_type::duration duration) {
+      return std::chrono::duration<double>(duration).count();
+    }
+
+  private:
+    engine_t& m_engine;
+  };
+
+  void
+  heartbeat_jitter(const std::vector<clock_type::time_point>& heartbeats,
+                   double interval,
+                   results_t& results)
+  {
+    if(heartbeats.size() < 2) {
+      return;
+    }
+
+    double total = 0.0,
+           worst = 0.0;
+
+    for(size_t i = 1; i < heartbeats.size(); ++i) {
+      const double jitter = std::abs(
+        std::chrono::duration<double>(heartbeats[i] - heartbeats[i - 1]).count() - interval
+      );
+
+      total += jitter;
+      worst = std::max(worst, jitter);
+    }
+
+    results["heartbeat-jitter-mean"] = total / (heartbeats.size() - 1);
+    results["heartbeat-jitter-max"] = worst;
+  }
+
+  void
+  compare(const results_t& results,
+          const std::string& path)
+  {
+    std::ifstream stream(path.c_str());
+    Json::Value baseline;
+
+    if(!Json::Reader().parse(stream, baseline)) {
+      throw cocaine::error_t("unable to parse the baseline '%s'", path);
+    }
+
+    std::cout << cocaine::format("%-28s %16s %16s %9s", "metric", "baseline", "current", "change")
+              << std::endl;
+
+    for(results_t::const_iterator it = results.begin(); it != results.end(); ++it) {
+      if(!baseline.isMember(it->first)) {
+        continue;
+      }
+
+      const double before = baseline[it->first].asDouble();
+
+      std::cout << cocaine::format(
+        "%-28s %16.2f %16.2f %+8.1f%%",
+        it->first,
+        before,
+        it->second,
+        before != 0.0 ? (it->second - before) / before * 100.0 : 0.0
+      ) << std::endl;
+    }
+  }
+}
+
+int main(int argc, char * argv[]) {
+  po::options_description options("Options");
+  po::variables_map vm;
+
+  options.add_options()
+    ("help,h", "show this message")
+    ("requests", po::value<size_t>()->default_value(20000),
+     "number of requests for the invoke throughput and latency runs")
+    ("window", po::value<size_t>()->default_value(256),
+     "number of requests in flight for the invoke throughput run")
+    ("volume", po::value<size_t>()->default_value(64 << 20),
+     "number of bytes streamed in every chunk throughput run")
+    ("shm-threshold", po::value<size_t>()->default_value(0),
+     "send the chunks of this size and more through shared memory")
+    ("baseline", po::value<std::string>(),
+     "compare the results against a previously saved run")
+    ("save", po::value<std::string>(),
+     "save the results for future comparisons");
+
+  try {
+    po::store(po::parse_command_line(argc, argv, options), vm);
+    po::notify(vm);
+  } catch(const po::error& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if(vm.count("help")) {
+    std::cout << "Usage: " << argv[0] << " [options]" << std::endl;
+    std::cout << options;
+    return EXIT_SUCCESS;
+  }
+
+  const size_t requests = vm["requests"].as<size_t>(),
+               volume = vm["volume"].as<size_t>(),
+               threshold = vm["shm-threshold"].as<size_t>();
+
+  results_t results;
+
+  try {
+    fixture_t fixture(threshold);
+
+    context_t context((fixture.root / "cocaine.conf").string(), "bench");
+    zmq::context_t io(1);
+
+    engine_t engine(io, fixture.endpoint());
+
+    if(threshold) {
+      engine.share(threshold);
+    }
+
+    worker_config_t config;
+
+    config.app = "bench";
+    config.profile = "bench";
+    config.uuid = unique_id_t().string();
+    config.sandbox = &make_sandbox;
+
+    worker_t worker(context, config);
+    boost::thread thread(boost::bind(&worker_t::run, &worker));
+
+    if(!engine.accept(5000)) {
+      throw cocaine::error_t("the worker has failed to connect");
+    }
+
+    runner_t runner(engine);
+
+    results["invoke-throughput"] = runner.invoke_throughput(requests, vm["window"].as<size_t>());
+
+    const size_t sizes[] = { 64, 1024, 16384, 262144 };
+
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+      results[cocaine::format("chunk-throughput-%d", sizes[i])] = runner.chunk_throughput(sizes[i], volume);
+    }
+
+    results["mirror-throughput-262144"] = runner.mirror_throughput(262144, volume);
+
+    // NOTE: Both the worker and the engine fall back to the channel once the
+    // rings are full, but that can't be the case for every chunk.
+    if(threshold && threshold <= 262144 && engine.shared() == 0) {
+      throw cocaine::error_t("the worker has sent nothing through shared memory");
+    }
+
+    results["shm-chunks"] = engine.shared();
+
+    histogram_t latency;
+
+    runner.choke_latency(requests / 10, latency);
+
+    results["choke-latency-p50"] = latency.quantile(0.5);
+    results["choke-latency-p99"] = latency.quantile(0.99);
+    results["choke-latency-p999"] = latency.quantile(0.999);
+
+    heartbeat_jitter(engine.heartbeats(), 0.5, results);
+
+    engine.terminate();
+    thread.join();
+  } catch(const std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  Json::Value output(Json::objectValue);
+
+  for(results_t::const_iterator it = results.begin(); it != results.end(); ++it) {
+    output[it->first] = it->second;
+  }
+
+  std::cout << Json::StyledWriter().write(output);
+
+  if(vm.count("baseline")) {
+    try {
+      compare(results, vm["baseline"].as<std::string>());
+    } catch(const std::exception& e) {
+      std::cerr << "Error: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if(vm.count("save")) {
+    std::ofstream stream(vm["save"].as<std::string>().c_str());
+    stream << Json::StyledWriter().write(output);
+  }
+
+  return EXIT_SUCCESS;
+}
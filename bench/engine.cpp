@@ -0,0 +1,251 @@
+#include "engine.hpp"
+
+#include <cocaine/rpc.hpp>
+#include <cocaine/traits.hpp>
+
+#include <cocaine/traits/unique_id.hpp>
+
+#include <cstring>
+
+using namespace cocaine;
+using namespace cocaine::bench;
+using namespace cocaine::io;
+
+namespace {
+  template<class T>
+  void
+  unpack(zmq::message_t& frame,
+         T& target)
+  {
+    msgpack::unpacked unpacked;
+
+    msgpack::unpack(&unpacked, static_cast<const char*>(frame.data()), frame.size());
+    type_traits<T>::unpack(unpacked.get(), target);
+  }
+}
+
+template<class T>
+void
+engine_t::send(const T& value,
+               int flags)
+{
+  msgpack::sbuffer buffer;
+  msgpack::packer<msgpack::sbuffer> packer(buffer);
+
+  type_traits<T>::pack(packer, value);
+
+  zmq::message_t frame(buffer.size());
+
+  std::memcpy(frame.data(), buffer.data(), buffer.size());
+
+  m_socket.send(frame, flags);
+}
+
+engine_t::engine_t(zmq::context_t& context,
+                   const std::string& endpoint):
+  m_socket(context, ZMQ_ROUTER),
+  m_threshold(0),
+  m_shared(0)
+{
+  // NOTE: A ROUTER silently drops messages once the high water mark is hit,
+  // so the queue is unbounded to keep the measurements honest.
+  int hwm = 0;
+
+  m_socket.setsockopt(ZMQ_SNDHWM, &hwm, sizeof(hwm));
+  m_socket.setsockopt(ZMQ_RCVHWM, &hwm, sizeof(hwm));
+
+  m_socket.bind(endpoint.c_str());
+}
+
+bool
+engine_t::accept(int timeout) {
+  message_t message;
+
+  while(m_identity.empty()) {
+    if(!recv(message, timeout)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void
+engine_t::invoke(const unique_id_t& session,
+                 const std::string& event)
+{
+  send_header(event_traits<rpc::invoke>::id, ZMQ_SNDMORE);
+  send(session, ZMQ_SNDMORE);
+  send(event);
+}
+
+void
+engine_t::chunk(const unique_id_t& session,
+                const std::string& data)
+{
+  if(m_side && data.size() >= m_threshold) {
+    msgpack::sbuffer buffer;
+    msgpack::packer<msgpack::sbuffer> packer(buffer);
+
+    type_traits<std::string>::pack(packer, data);
+
+    uint64_t offset = 0;
+
+    if(m_side->write(buffer.data(), buffer.size(), offset)) {
+      send_header(event_traits<engine::shm::chunk>::id, ZMQ_SNDMORE);
+      send(session, ZMQ_SNDMORE);
+      send(offset, ZMQ_SNDMORE);
+      send(static_cast<uint64_t>(buffer.size()));
+
+      return;
+    }
+  }
+
+  send_header(event_traits<rpc::chunk>::id, ZMQ_SNDMORE);
+  send(session, ZMQ_SNDMORE);
+  send(data);
+}
+
+void
+engine_t::choke(const unique_id_t& session) {
+  send_header(event_traits<rpc::choke>::id, ZMQ_SNDMORE);
+  send(session);
+}
+
+void
+engine_t::heartbeat() {
+  send_header(event_traits<rpc::heartbeat>::id, 0);
+}
+
+void
+engine_t::terminate() {
+  send_header(event_traits<rpc::terminate>::id, 0);
+}
+
+bool
+engine_t::recv(message_t& message,
+               int timeout)
+{
+  zmq_pollitem_t item = { m_socket, 0, ZMQ_POLLIN, 0 };
+
+  if(zmq_poll(&item, 1, timeout) <= 0) {
+    return false;
+  }
+
+  zmq::message_t frame;
+
+  m_socket.recv(&frame);
+
+  if(m_identity.empty()) {
+    m_identity.assign(static_cast<const char*>(frame.data()), frame.size());
+  }
+
+  m_socket.recv(&frame);
+  unpack(frame, message.type);
+
+  message.data.clear();
+
+  switch(message.type) {
+    case event_traits<rpc::heartbeat>::id:
+      m_heartbeats.push_back(clock_type::now());
+      break;
+
+    case event_traits<rpc::chunk>::id:
+      m_socket.recv(&frame);
+      unpack(frame, message.session);
+
+      m_socket.recv(&frame);
+      unpack(frame, message.data);
+
+      break;
+
+    case event_traits<engine::shm::offer>::id: {
+      std::string name;
+      uint64_t size = 0;
+
+      m_socket.recv(&frame);
+      unpack(frame, name);
+
+      m_socket.recv(&frame);
+      unpack(frame, size);
+
+      // NOTE: Without a threshold, the engine acts like one which doesn't
+      // know the extension at all.
+      if(m_threshold) {
+        m_side = engine::side_channel_t::open(name);
+        m_side->accept();
+
+        send_header(event_traits<engine::shm::accept>::id, 0);
+      }
+
+      break;
+    }
+
+    case event_traits<engine::shm::chunk>::id: {
+      uint64_t offset = 0,
+               size = 0;
+
+      m_socket.recv(&frame);
+      unpack(frame, message.session);
+
+      m_socket.recv(&frame);
+      unpack(frame, offset);
+
+      m_socket.recv(&frame);
+      unpack(frame, size);
+
+      // NOTE: The record is released once the frame is gone.
+      zmq::message_t shared;
+
+      if(!m_side || !m_side->read(offset, size, shared)) {
+        throw cocaine::error_t("the worker has sent a bogus shared memory descriptor");
+      }
+
+      message.type = event_traits<rpc::chunk>::id;
+      unpack(shared, message.data);
+
+      ++m_shared;
+
+      break;
+    }
+
+    case event_traits<rpc::error>::id:
+    case event_traits<rpc::choke>::id:
+      m_socket.recv(&frame);
+      unpack(frame, message.session);
+
+      break;
+
+    default:
+      break;
+  }
+
+  while(more()) {
+    m_socket.recv(&frame);
+  }
+
+  return true;
+}
+
+void
+engine_t::send_header(int type,
+                      int flags)
+{
+  zmq::message_t identity(m_identity.size());
+
+  std::memcpy(identity.data(), m_identity.data(), m_identity.size());
+
+  m_socket.send(identity, ZMQ_SNDMORE);
+
+  send(type, flags);
+}
+
+bool
+engine_t::more() {
+  int more = 0;
+  size_t size = sizeof(more);
+
+  m_socket.getsockopt(ZMQ_RCVMORE, &more, &size);
+
+  return more != 0;
+}
@@ -0,0 +1,114 @@
+#ifndef COCAINE_GENERIC_WORKER_BENCH_ENGINE_HPP
+#define COCAINE_GENERIC_WORKER_BENCH_ENGINE_HPP
+
+#include <cocaine/common.hpp>
+#include <cocaine/unique_id.hpp>
+
+#include <chrono>
+
+#include <zmq.hpp>
+
+#include "shm.hpp"
+
+namespace cocaine { namespace bench {
+
+    typedef std::chrono::steady_clock clock_type;
+
+    // A message received from the worker. Session-less messages, like
+    // heartbeats, leave the session untouched.
+    struct message_t {
+      message_t():
+        type(-1),
+        session(uninitialized)
+      { }
+
+      int type;
+      unique_id_t session;
+
+      // Decoded payload for chunks, whichever way they have arrived.
+      std::string data;
+    };
+
+    // Stand-in for the engine side of the worker protocol. It binds the
+    // ROUTER socket a worker connects to and speaks to a single worker.
+    class engine_t:
+    public boost::noncopyable
+    {
+    public:
+      engine_t(zmq::context_t& context,
+               const std::string& endpoint);
+
+      // Waits for the first message from the worker, returns false on timeout.
+      bool
+      accept(int timeout);
+
+      // Accepts the shared memory offered by the worker, and sends the chunks
+      // of the given size and more through it, see side_channel_t.
+      void
+      share(size_t threshold) {
+        m_threshold = threshold;
+      }
+
+      void
+      invoke(const unique_id_t& session,
+             const std::string& event);
+
+      void
+      chunk(const unique_id_t& session,
+            const std::string& data);
+
+      void
+      choke(const unique_id_t& session);
+
+      void
+      heartbeat();
+
+      void
+      terminate();
+
+      // Receives a single message, returns false on timeout. Timeouts are
+      // in milliseconds.
+      bool
+      recv(message_t& message,
+           int timeout);
+
+      // Arrival times of the heartbeats received so far.
+      const std::vector<clock_type::time_point>&
+      heartbeats() const {
+        return m_heartbeats;
+      }
+
+      // Chunks received through shared memory so far.
+      size_t
+      shared() const {
+        return m_shared;
+      }
+
+    private:
+      void
+      send_header(int type,
+                  int flags);
+
+      template<class T>
+      void
+      send(const T& value,
+           int flags = 0);
+
+      bool
+      more();
+
+    private:
+      zmq::socket_t m_socket;
+      std::string m_identity;
+
+      std::vector<clock_type::time_point> m_heartbeats;
+
+      size_t m_threshold,
+             m_shared;
+
+      std::unique_ptr<engine::side_channel_t> m_side;
+    };
+
+  }} // namespace cocaine::bench
+
+#endif
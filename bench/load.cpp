@@ -0,0 +1,360 @@
+#include "engine.hpp"
+#include "metrics.hpp"
+#include "session_map.hpp"
+
+#include <cocaine/rpc.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <queue>
+#include <random>
+
+#include <boost/program_options.hpp>
+
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace cocaine;
+using namespace cocaine::bench;
+using namespace cocaine::engine;
+using namespace cocaine::io;
+
+namespace po = boost::program_options;
+
+namespace {
+  // Chunk sizes, given either as a fixed "N", a uniform "MIN-MAX" range, or
+  // an exponential distribution "exp:MEAN".
+  class distribution_t {
+  public:
+    explicit
+    distribution_t(const std::string& spec):
+      m_exponential(false),
+      m_minimum(0),
+      m_maximum(0),
+      m_mean(0.0)
+    {
+      const size_t dash = spec.find('-');
+
+      if(spec.compare(0, 4, "exp:") == 0) {
+        m_exponential = true;
+        m_mean = std::strtod(spec.c_str() + 4, nullptr);
+      } else if(dash != std::string::npos) {
+        m_minimum = std::strtoul(spec.substr(0, dash).c_str(), nullptr, 10);
+        m_maximum = std::strtoul(spec.substr(dash + 1).c_str(), nullptr, 10);
+      } else {
+        m_minimum = m_maximum = std::strtoul(spec.c_str(), nullptr, 10);
+      }
+
+      if(m_exponential ? m_mean <= 0.0 : m_minimum > m_maximum) {
+        throw cocaine::error_t("invalid chunk size distribution '%s'", spec);
+      }
+    }
+
+    template<class Generator>
+    size_t
+    operator()(Generator& generator) {
+      if(m_exponential) {
+        return std::exponential_distribution<double>(1.0 / m_mean)(generator);
+      }
+
+      return std::uniform_int_distribution<size_t>(m_minimum, m_maximum)(generator);
+    }
+
+  private:
+    bool m_exponential;
+
+    size_t m_minimum,
+           m_maximum;
+
+    double m_mean;
+  };
+
+  struct session_t {
+    clock_type::time_point started;
+
+    // Chunks still to be sent, the choke follows the last one.
+    size_t remaining;
+  };
+
+  typedef std::pair<clock_type::time_point, unique_id_t> step_t;
+
+  struct later_t {
+    bool
+    operator()(const step_t& lhs,
+               const step_t& rhs) const
+    {
+      return lhs.first > rhs.first;
+    }
+  };
+
+  // Consumed CPU time of the process in seconds.
+  double
+  cpu_time(pid_t pid) {
+    std::ifstream stream(cocaine::format("/proc/%d/stat", pid).c_str());
+    std::string field;
+
+    unsigned long long utime = 0,
+                       stime = 0;
+
+    // NOTE: The user and system times are the 14th and the 15th fields.
+    for(int i = 1; i <= 15 && stream >> field; ++i) {
+      if(i == 14) {
+        utime = std::strtoull(field.c_str(), nullptr, 10);
+      } else if(i == 15) {
+        stime = std::strtoull(field.c_str(), nullptr, 10);
+      }
+    }
+
+    return static_cast<double>(utime + stime) / ::sysconf(_SC_CLK_TCK);
+  }
+
+  std::string
+  runtime_path(const std::string& configuration) {
+    std::ifstream stream(configuration.c_str());
+    Json::Value root;
+
+    if(!Json::Reader().parse(stream, root)) {
+      throw cocaine::error_t("unable to parse the configuration '%s'", configuration);
+    }
+
+    return root["paths"].get("runtime", "/var/run/cocaine").asString();
+  }
+
+  pid_t
+  spawn(const std::string& slave,
+        const std::string& configuration,
+        const std::string& app,
+        const std::string& profile)
+  {
+    const std::string uuid = unique_id_t().string();
+
+    const pid_t pid = ::fork();
+
+    if(pid < 0) {
+      throw cocaine::error_t("unable to fork - %s", std::strerror(errno));
+    }
+
+    if(pid == 0) {
+      ::execl(
+        slave.c_str(),
+        slave.c_str(),
+        "--configuration", configuration.c_str(),
+        "--app", app.c_str(),
+        "--profile", profile.c_str(),
+        "--uuid", uuid.c_str(),
+        static_cast<char*>(nullptr)
+      );
+
+      std::cerr << "Error: unable to execute '" << slave << "' - " << std::strerror(errno) << std::endl;
+      ::_exit(EXIT_FAILURE);
+    }
+
+    return pid;
+  }
+}
+
+int main(int argc, char * argv[]) {
+  po::options_description options("Options");
+  po::variables_map vm;
+
+  options.add_options()
+    ("help,h", "show this message")
+    ("configuration,c", po::value<std::string>()->default_value("/etc/cocaine/cocaine.conf"),
+     "location of the configuration file")
+    ("app", po::value<std::string>(), "app name")
+    ("profile", po::value<std::string>()->default_value("default"), "app profile")
+    ("slave", po::value<std::string>(),
+     "worker executable to spawn, otherwise a worker is expected to connect on its own")
+    ("pid", po::value<pid_t>(), "pid of an externally started worker, to measure its CPU usage")
+    ("event", po::value<std::string>()->default_value("ping"), "event to invoke")
+    ("sessions", po::value<size_t>()->default_value(100000), "total number of sessions")
+    ("concurrency", po::value<size_t>()->default_value(1000), "number of sessions in flight")
+    ("chunks", po::value<size_t>()->default_value(1), "number of chunks sent in every session")
+    ("chunk-size", po::value<std::string>()->default_value("1024"),
+     "chunk size: N, MIN-MAX or exp:MEAN")
+    ("think", po::value<double>()->default_value(0.0),
+     "pause between the messages of a session, in milliseconds");
+
+  try {
+    po::store(po::parse_command_line(argc, argv, options), vm);
+    po::notify(vm);
+  } catch(const po::error& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if(vm.count("help") || !vm.count("app")) {
+    std::cout << "Usage: " << argv[0] << " --app APP [options]" << std::endl;
+    std::cout << options;
+    return vm.count("help") ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  const std::string configuration = vm["configuration"].as<std::string>(),
+                    app = vm["app"].as<std::string>(),
+                    event = vm["event"].as<std::string>();
+
+  const size_t total = vm["sessions"].as<size_t>(),
+               concurrency = vm["concurrency"].as<size_t>(),
+               chunks = vm["chunks"].as<size_t>();
+
+  const clock_type::duration think = std::chrono::duration_cast<clock_type::duration>(
+    std::chrono::duration<double, std::milli>(vm["think"].as<double>())
+  );
+
+  histogram_t latency;
+
+  size_t done = 0,
+         errors = 0;
+
+  double elapsed = 0.0,
+         cpu = 0.0;
+
+  pid_t pid = vm.count("pid") ? vm["pid"].as<pid_t>() : 0;
+
+  try {
+    distribution_t sizes(vm["chunk-size"].as<std::string>());
+    std::mt19937 generator(std::random_device{}());
+
+    zmq::context_t io(1);
+
+    engine_t engine(io, cocaine::format("ipc://%s/engines/%s", runtime_path(configuration), app));
+
+    if(vm.count("slave")) {
+      pid = spawn(vm["slave"].as<std::string>(), configuration, app, vm["profile"].as<std::string>());
+    }
+
+    if(!engine.accept(30000)) {
+      throw cocaine::error_t("no worker has connected");
+    }
+
+    session_map_t<session_t> sessions(concurrency);
+    std::priority_queue<step_t, std::vector<step_t>, later_t> schedule;
+
+    std::string payload;
+
+    const double cpu_started = pid ? cpu_time(pid) : 0.0;
+    const clock_type::time_point started = clock_type::now();
+
+    size_t launched = 0;
+
+    while(done < total) {
+      clock_type::time_point now = clock_type::now();
+
+      while(launched < total && sessions.size() < concurrency) {
+        const unique_id_t id;
+
+        session_t session = { now, chunks };
+
+        sessions.emplace(id, session);
+        engine.invoke(id, event);
+        schedule.push(std::make_pair(now + think, id));
+
+        ++launched;
+      }
+
+      while(!schedule.empty() && schedule.top().first <= now) {
+        const unique_id_t id = schedule.top().second;
+
+        schedule.pop();
+
+        session_map_t<session_t>::iterator it(sessions.find(id));
+
+        // NOTE: The worker might have choked the session before it has been
+        // sent in full, e.g. on an invocation error.
+        if(it == sessions.end()) {
+          continue;
+        }
+
+        if(it->second.remaining) {
+          payload.assign(sizes(generator), 'x');
+          engine.chunk(id, payload);
+
+          --it->second.remaining;
+
+          schedule.push(std::make_pair(now + think, id));
+        } else {
+          engine.choke(id);
+        }
+      }
+
+      int timeout = 100;
+
+      if(!schedule.empty()) {
+        timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+          schedule.top().first - clock_type::now()
+        ).count();
+
+        timeout = std::max(0, timeout);
+      }
+
+      message_t message;
+
+      while(engine.recv(message, timeout)) {
+        timeout = 0;
+
+        if(message.type == event_traits<rpc::heartbeat>::id) {
+          engine.heartbeat();
+          continue;
+        }
+
+        if(message.type == event_traits<rpc::error>::id) {
+          ++errors;
+          continue;
+        }
+
+        if(message.type != event_traits<rpc::choke>::id) {
+          continue;
+        }
+
+        session_map_t<session_t>::iterator it(sessions.find(message.session));
+
+        if(it == sessions.end()) {
+          continue;
+        }
+
+        latency.record(microseconds(clock_type::now() - it->second.started));
+        sessions.erase(it);
+
+        ++done;
+      }
+
+      if(vm.count("slave") && ::waitpid(pid, nullptr, WNOHANG) == pid) {
+        throw cocaine::error_t("the worker has died");
+      }
+    }
+
+    elapsed = std::chrono::duration<double>(clock_type::now() - started).count();
+    cpu = pid ? cpu_time(pid) - cpu_started : 0.0;
+
+    // NOTE: An externally started worker is asked to go away as well, so
+    // that it doesn't stay around with nobody to talk to.
+    engine.terminate();
+
+    if(vm.count("slave")) {
+      ::waitpid(pid, nullptr, 0);
+    }
+  } catch(const std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  Json::Value report(Json::objectValue);
+
+  report["sessions"] = static_cast<Json::UInt64>(done);
+  report["errors"] = static_cast<Json::UInt64>(errors);
+  report["elapsed"] = elapsed;
+  report["throughput"] = done / elapsed;
+  report["latency"] = latency.snapshot();
+
+  if(pid) {
+    report["cpu"] = cpu;
+    report["cpu-per-request"] = cpu / done;
+  }
+
+  std::cout << Json::StyledWriter().write(report);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,76 @@
+#ifndef COCAINE_GENERIC_WORKER_BATCH_HPP
+#define COCAINE_GENERIC_WORKER_BATCH_HPP
+
+#include <cocaine/common.hpp>
+#include <cocaine/unique_id.hpp>
+
+#include <cocaine/api/stream.hpp>
+
+#include <deque>
+
+#include "chunk.hpp"
+
+namespace cocaine { namespace engine {
+
+    // Optional interface for sandboxes. When the sandbox also implements it,
+    // the invokes, chunks and chokes received within a loop iteration are
+    // handed over in a single call, so that the sandbox enters its runtime
+    // once per batch instead of once per message.
+    class batch_sandbox_t {
+    public:
+      // A session with messages in the batch.
+      struct session_t {
+        unique_id_t id;
+
+        // The event, for the sessions invoked within the batch only.
+        std::string event;
+
+        boost::shared_ptr<api::stream_t> upstream;
+
+        // Set by the sandbox when it handles the invoke, and given for the
+        // sessions invoked earlier.
+        boost::shared_ptr<api::stream_t> downstream;
+
+        // Set by the sandbox once the session has failed, which then gets
+        // an invocation error and is dropped along with its later messages.
+        std::string error;
+
+        bool choked;
+      };
+
+      struct message_t {
+        enum class type_t: int {
+          invoke,
+          chunk,
+          choke
+        };
+
+        type_t type;
+        session_t * session;
+
+        // For chunks only, see chunk_sink_t on holding on to it.
+        chunk_t chunk;
+      };
+
+      // NOTE: The messages are in the order of arrival, so those of every
+      // session come in the same order as they would one by one.
+      struct batch_t {
+        std::deque<session_t> sessions;
+        std::vector<message_t> messages;
+      };
+
+      virtual
+      ~batch_sandbox_t() {
+        // Empty.
+      }
+
+      // Should report failures per session, if it throws, every session in
+      // the batch fails.
+      virtual
+      void
+      push(batch_t& batch) = 0;
+    };
+
+  }} // namespace cocaine::engine
+
+#endif
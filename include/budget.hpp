@@ -0,0 +1,56 @@
+#ifndef COCAINE_GENERIC_WORKER_BUDGET_HPP
+#define COCAINE_GENERIC_WORKER_BUDGET_HPP
+
+#include <cocaine/common.hpp>
+
+#include <chrono>
+
+namespace cocaine { namespace engine {
+
+    // Limits a single channel drain both in messages and in wall time. The
+    // message limit adapts: it grows while drains end early and cheaply with
+    // more messages still queued, and shrinks once the time slice overruns,
+    // e.g. when the sandbox starts running long handlers.
+    class io_budget_t {
+    public:
+      typedef std::chrono::steady_clock clock_type;
+
+      io_budget_t(unsigned long initial,
+                  unsigned long minimum,
+                  unsigned long maximum,
+                  double slice);
+
+      // Starts a new drain.
+      void
+      start();
+
+      // Accounts for a processed message, returns false once the drain has
+      // to yield back to the event loop.
+      bool
+      consume();
+
+      // Completes the drain, the flag tells whether the channel ran dry.
+      void
+      finish(bool drained);
+
+      unsigned long
+      limit() const {
+        return m_limit;
+      }
+
+    private:
+      const unsigned long m_minimum,
+                          m_maximum;
+
+      const clock_type::duration m_slice;
+
+      unsigned long m_limit,
+                    m_processed;
+
+      clock_type::time_point m_started;
+      bool m_overrun;
+    };
+
+  }} // namespace cocaine::engine
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef COCAINE_GENERIC_WORKER_CHUNK_HPP
+#define COCAINE_GENERIC_WORKER_CHUNK_HPP
+
+#include <cocaine/common.hpp>
+
+#include <zmq.hpp>
+
+namespace cocaine { namespace engine {
+
+    // A chunk payload which points directly into the received ZeroMQ frame
+    // and keeps that frame alive for as long as any copy of it exists.
+    class chunk_t {
+    public:
+      // An empty chunk.
+      chunk_t():
+        m_data(nullptr),
+        m_size(0)
+      { }
+
+      // Unwraps the msgpack string stored in the frame without copying it.
+      static
+      chunk_t
+      decode(const boost::shared_ptr<zmq::message_t>& frame);
+
+      const char*
+      data() const {
+        return m_data;
+      }
+
+      size_t
+      size() const {
+        return m_size;
+      }
+
+    private:
+      chunk_t(const boost::shared_ptr<zmq::message_t>& frame,
+              const char * data,
+              size_t size);
+
+    private:
+      boost::shared_ptr<zmq::message_t> m_frame;
+
+      const char * m_data;
+      size_t m_size;
+    };
+
+    // Optional interface for sandbox downstreams. When a downstream also
+    // implements it, chunks are handed over with their ownership, so that
+    // the sandbox can retain them instead of copying within push().
+    //
+    // NOTE: Retained chunks come from the worker's allocation pool, so they
+    // must be released on the worker thread.
+    class chunk_sink_t {
+    public:
+      virtual
+      ~chunk_sink_t() {
+        // Empty.
+      }
+
+      virtual
+      void
+      push(const chunk_t& chunk) = 0;
+    };
+
+    // Releases a buffer passed to owning_stream_t::push(), see below.
+    typedef void (*release_t)(void * data, void * hint);
+
+    // Optional interface implemented by the worker upstreams. The buffer is
+    // placed into the outgoing frame as is, and ownership passes to ZeroMQ.
+    //
+    // If at least five bytes right before the data are writable, as given by
+    // the headroom, the frame header is written there and nothing is copied
+    // at all. Otherwise the payload is copied once and released immediately.
+    // With owning_headroom bytes, the release bookkeeping goes in there too,
+    // and nothing is allocated either.
+    //
+    // NOTE: The release callback is called exactly once, even if push()
+    // throws, but possibly from a ZeroMQ I/O thread, so it must not touch
+    // the JS heap directly.
+    class owning_stream_t {
+    public:
+      virtual
+      ~owning_stream_t() {
+        // Empty.
+      }
+
+      virtual
+      void
+      push(char * data,
+           size_t size,
+           size_t headroom,
+           release_t release,
+           void * hint) = 0;
+    };
+
+    // Headroom enough for both the frame header and the release bookkeeping.
+    const size_t owning_headroom = 40;
+
+    // Builds an outgoing chunk frame, copying the payload exactly once. Both
+    // throw for chunks of 4GiB and more, which the header can't describe.
+    void
+    pack_chunk(zmq::message_t& frame,
+               const char * data,
+               size_t size);
+
+    // Builds an outgoing chunk frame which owns the payload, as described
+    // for owning_stream_t::push().
+    void
+    pack_chunk(zmq::message_t& frame,
+               char * data,
+               size_t size,
+               size_t headroom,
+               release_t release,
+               void * hint);
+
+  }} // namespace cocaine::engine
+
+#endif
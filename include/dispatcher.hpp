@@ -0,0 +1,136 @@
+#ifndef COCAINE_GENERIC_WORKER_DISPATCHER_HPP
+#define COCAINE_GENERIC_WORKER_DISPATCHER_HPP
+
+#include <cocaine/common.hpp>
+#include <cocaine/unique_id.hpp>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+
+#include <zmq.hpp>
+
+#include "flow.hpp"
+
+namespace cocaine { namespace engine {
+
+    // A session which has been assigned to a shard but hasn't been started
+    // yet, along with whatever the engine has sent for it so far.
+    struct pending_t:
+      public boost::noncopyable
+    {
+      pending_t(const unique_id_t& session_id_,
+                const std::string& event_):
+        session_id(session_id_),
+        event(event_),
+        bytes(0),
+        choked(false),
+        owner(-1)
+      { }
+
+      const unique_id_t session_id;
+      const std::string event;
+
+      std::vector<std::unique_ptr<zmq::message_t>> chunks;
+      size_t bytes;
+      bool choked;
+
+      // The shard which has started the session, or -1 while it's queued.
+      std::atomic<int> owner;
+    };
+
+    // Queues of sessions waiting to be started, one per shard. A shard takes
+    // sessions off the front of its own queue, and once it runs out, it can
+    // steal them off the back of the longest queue of the others. Until the
+    // session is started, the worker thread buffers its messages in it, and
+    // afterwards they go straight to the shard which has started it.
+    //
+    // The buffered chunk bytes are charged against the worker budget, see
+    // flow_control_t, until the session is started and the shard's executor
+    // charges them on its own.
+    class dispatcher_t:
+      public boost::noncopyable
+    {
+    public:
+      dispatcher_t(size_t shards,
+                   size_t high,
+                   size_t low);
+
+      // Worker thread
+
+      void
+      push(size_t shard,
+           const boost::shared_ptr<pending_t>& session);
+
+      // Buffers the message unless the session has already been started,
+      // in which case it has to be sent over to the owner. Takes the
+      // contents of the frame only if it has been buffered.
+      bool
+      chunk(pending_t& session,
+            zmq::message_t& frame);
+
+      bool
+      choke(pending_t& session);
+
+      // Takes every queued session off the queues and refunds its buffered
+      // chunks, so that the worker could fail those instead of starting them.
+      std::vector<boost::shared_ptr<pending_t>>
+      cancel();
+
+      // Shard threads
+
+      // Takes the next session off the shard's own queue and marks it as
+      // started by the shard.
+      boost::shared_ptr<pending_t>
+      take(size_t shard);
+
+      // Same, but takes the most recently queued session of the longest
+      // queue of the other shards, if that one is behind.
+      boost::shared_ptr<pending_t>
+      steal(size_t shard);
+
+      // Refunds the buffered chunks of a session once they have been handed
+      // over to the executor. Returns true if that has ended a congestion.
+      bool
+      release(pending_t& session);
+
+      // Any thread, approximate.
+
+      size_t
+      depth(size_t shard) const {
+        return m_queues[shard].depth.load(std::memory_order_relaxed);
+      }
+
+      bool
+      congested() const {
+        return m_congested.load(std::memory_order_acquire);
+      }
+
+      size_t
+      buffered() const {
+        return m_buffered.load(std::memory_order_relaxed);
+      }
+
+    private:
+      struct queue_t {
+        queue_t():
+          depth(0)
+        { }
+
+        std::deque<boost::shared_ptr<pending_t>> sessions;
+        std::atomic<size_t> depth;
+      };
+
+      std::mutex m_mutex;
+      std::vector<queue_t> m_queues;
+
+      // Guarded by the mutex, and mirrored for the lock-free accessors.
+      watermark_t m_budget;
+
+      std::atomic<bool> m_congested;
+      std::atomic<size_t> m_buffered;
+    };
+
+  }} // namespace cocaine::engine
+
+#endif
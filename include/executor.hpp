@@ -0,0 +1,253 @@
+#ifndef COCAINE_GENERIC_WORKER_EXECUTOR_HPP
+#define COCAINE_GENERIC_WORKER_EXECUTOR_HPP
+
+#include <cocaine/common.hpp>
+#include <cocaine/unique_id.hpp>
+
+#include <cocaine/api/stream.hpp>
+
+#include "batch.hpp"
+#include "chunk.hpp"
+#include "flow.hpp"
+#include "metrics.hpp"
+#include "pool.hpp"
+#include "reactor.hpp"
+#include "session_map.hpp"
+#include "settings.hpp"
+#include "shm.hpp"
+#include "transport.hpp"
+#include "wheel.hpp"
+
+namespace cocaine { namespace engine {
+
+    class upstream_t;
+
+    // Runs the sessions of a single sandbox instance on a single loop: it
+    // creates the upstreams, feeds the downstreams and flushes coalesced
+    // chunks once per loop iteration. The worker has either one executor on
+    // its own loop, or one per thread, see shard_t.
+    class executor_t:
+    public boost::noncopyable
+    {
+    public:
+      // The worker-wide inflight budget is split evenly among the given
+      // number of executors. The callback is called once the sandbox has
+      // caught up after a congestion, see flow_control_t. Large chunks are
+      // sent through the side channel, if there's one.
+      executor_t(reactor_t& reactor,
+                 transport_t& transport,
+                 std::unique_ptr<api::sandbox_t> sandbox,
+                 const settings_t& settings,
+                 metrics_t& metrics,
+                 size_t shares,
+                 flow_control_t::callback_t resume,
+                 side_channel_t * side);
+
+      void
+      invoke(const unique_id_t& session_id,
+             const std::string& event);
+
+      // Takes the contents of the frame.
+      void
+      chunk(const unique_id_t& session_id,
+            zmq::message_t& frame);
+
+      void
+      choke(const unique_id_t& session_id);
+
+      // Fails every session which is still open and forgets them all, once
+      // the worker can't wait for the sandbox any longer. Returns the number
+      // of the sessions failed.
+      size_t
+      abort(error_code code,
+            const std::string& message);
+
+      // Upstream side
+
+      // Sends a prepacked rpc::chunk frame, see pack_chunk().
+      void
+      send_chunk(const unique_id_t& session_id,
+                 zmq::message_t& frame);
+
+      void
+      send_error(const unique_id_t& session_id,
+                 int code,
+                 const std::string& message);
+
+      void
+      send_choke(const unique_id_t& session_id);
+
+      // Flushes the upstream's coalesced chunks at the end of the current
+      // loop iteration.
+      void
+      defer(const boost::shared_ptr<upstream_t>& upstream);
+
+      // Swaps a coalescing buffer into the empty string, and back out once
+      // it has been flushed, so that the upstreams share a few buffers
+      // instead of allocating one each.
+      void
+      take_buffer(std::string& buffer);
+
+      void
+      recycle_buffer(std::string& buffer);
+
+      bool
+      writable() const {
+        return m_transport.writable();
+      }
+
+      // Notifies the upstream once the transport has drained, see drained().
+      void
+      wait_drain(const boost::shared_ptr<upstream_t>& upstream);
+
+      // Called by the owner once the transport is writable again.
+      void
+      drained();
+
+      // Load
+
+      size_t
+      sessions() const {
+        return m_streams.size();
+      }
+
+      // Sessions which haven't sent their choke yet, whether the engine has
+      // sent its own or not.
+      size_t
+      open() const {
+        return m_open;
+      }
+
+      bool
+      congested() const {
+        return m_flow.congested();
+      }
+
+      size_t
+      inflight() const {
+        return m_flow.inflight();
+      }
+
+      const pool_t&
+      pool() const {
+        return m_pool;
+      }
+
+      // Current tick of the session reaper, as of the loop time.
+      uint64_t
+      tick() const;
+
+    private:
+      struct io_pair_t;
+
+      void
+      on_flush();
+
+      // Hands the batched messages over to the sandbox.
+      void
+      commit();
+
+      // The session's entry in the pending batch.
+      batch_sandbox_t::session_t&
+      slot(io_pair_t& io,
+           const unique_id_t& session_id);
+
+      void
+      on_reap();
+
+      // Drops the session if it has expired, or schedules the next check.
+      void
+      reap(const unique_id_t& session_id);
+
+      void
+      schedule(const unique_id_t& session_id,
+               const io_pair_t& io);
+
+      histogram_t&
+      latency(const std::string& event);
+
+    private:
+      reactor_t& m_reactor;
+      transport_t& m_transport;
+      metrics_t& m_metrics;
+
+      const size_t m_coalesce;
+
+      side_channel_t * const m_side;
+      const size_t m_side_threshold;
+
+      // Session state allocations, the pool has to outlive the sandbox.
+      pool_t m_pool;
+
+      // Inbound flow control, it has to outlive the sandbox as well.
+      flow_control_t m_flow;
+
+      // Upstreams with coalesced chunks waiting for the end of the iteration,
+      // and those waiting for the transport to drain.
+      std::unique_ptr<prepare_watcher_t> m_flusher;
+      std::vector<boost::weak_ptr<upstream_t>> m_deferred,
+                                               m_blocked;
+
+      // Spare coalescing buffers, never more than were in use at once.
+      std::vector<std::string> m_buffers;
+
+      // Session timeouts in reaper ticks, zero is unlimited. The wheel is
+      // only turning while there are sessions to check.
+      const uint64_t m_idle_timeout,
+                     m_timeout;
+
+      const double m_epoch;
+
+      timer_wheel_t<unique_id_t> m_wheel;
+      std::unique_ptr<timer_watcher_t> m_reaper;
+      bool m_reaping;
+
+      // Latency histograms looked up so far, to keep the shared map out of
+      // the way of the invokes.
+      std::map<std::string, histogram_t*> m_latencies;
+
+      // Upstreams yet to be closed, which might outlive the sandbox.
+      size_t m_open;
+
+      // The app
+
+      std::unique_ptr<api::sandbox_t> m_sandbox;
+
+      // The sandbox itself, if it takes the messages in batches, and the
+      // messages received within the current loop iteration.
+      batch_sandbox_t * m_batched;
+      batch_sandbox_t::batch_t m_batch;
+
+      struct io_pair_t {
+        boost::shared_ptr<upstream_t> upstream;
+        boost::shared_ptr<api::stream_t> downstream;
+
+        // The downstream itself, if it can take ownership of chunks.
+        chunk_sink_t * sink;
+
+        // The session's entry in the pending batch, if it has one.
+        batch_sandbox_t::session_t * slot;
+
+        // Inflight bytes of the session, if they are limited.
+        boost::shared_ptr<watermark_t> budget;
+
+        // Reaper ticks of the last chunk received, and of the absolute
+        // deadline, if there's one.
+        uint64_t activity,
+                 deadline;
+      };
+
+      typedef session_map_t<io_pair_t> stream_map_t;
+
+      // Fails the session on a malformed chunk.
+      void
+      fail(stream_map_t::iterator it,
+           const std::string& message);
+
+      // Session streams.
+      stream_map_t m_streams;
+    };
+
+  }} // namespace cocaine::engine
+
+#endif
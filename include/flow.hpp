@@ -0,0 +1,113 @@
+#ifndef COCAINE_GENERIC_WORKER_FLOW_HPP
+#define COCAINE_GENERIC_WORKER_FLOW_HPP
+
+#include <cocaine/common.hpp>
+
+#include <zmq.hpp>
+
+#include "pool.hpp"
+
+namespace cocaine { namespace engine {
+
+    // Inflight byte counter with hysteresis: it becomes congested once the
+    // count reaches the high watermark and stays so until it drops to the
+    // low one. A zero high watermark disables the limit.
+    class watermark_t {
+    public:
+      watermark_t(size_t high,
+                  size_t low);
+
+      // Both return true if the congestion state has flipped.
+      bool
+      acquire(size_t size);
+
+      bool
+      release(size_t size);
+
+      bool
+      congested() const {
+        return m_congested;
+      }
+
+      size_t
+      inflight() const {
+        return m_inflight;
+      }
+
+    private:
+      const size_t m_high,
+                   m_low;
+
+      size_t m_inflight;
+      bool m_congested;
+    };
+
+    // Inbound flow control. Chunk payloads are charged against the budgets
+    // of their session and of the whole worker from the moment they are
+    // received until the sandbox lets go of them, which is right after the
+    // push() for plain downstreams, or once the last retained copy is gone
+    // for chunk sinks. While any budget is congested, the worker stops
+    // reading its channel and leaves the backlog to ZeroMQ and the engine.
+    class flow_control_t:
+    public boost::noncopyable
+    {
+    public:
+      typedef std::function<void()> callback_t;
+
+      // The callback is called once every budget has drained below its low
+      // watermark after a congestion.
+      flow_control_t(pool_t& pool,
+                     size_t session_high,
+                     size_t session_low,
+                     size_t worker_high,
+                     size_t worker_low,
+                     callback_t resume);
+
+      bool
+      enabled() const;
+
+      // A budget for a new session, null if sessions are not limited.
+      boost::shared_ptr<watermark_t>
+      session();
+
+      // Charges the received frame, the returned handle to it refunds the
+      // charge once its last copy is gone.
+      boost::shared_ptr<zmq::message_t>
+      charge(const boost::shared_ptr<zmq::message_t>& frame,
+             const boost::shared_ptr<watermark_t>& session);
+
+      bool
+      congested() const {
+        return m_worker.congested() || m_congested_sessions != 0;
+      }
+
+      size_t
+      inflight() const {
+        return m_worker.inflight();
+      }
+
+    private:
+      struct refund_t;
+
+      void
+      refund(size_t size,
+             watermark_t * session);
+
+    private:
+      pool_t& m_pool;
+
+      const size_t m_session_high,
+                   m_session_low,
+                   m_worker_high;
+
+      watermark_t m_worker;
+
+      // Sessions over their own budget.
+      size_t m_congested_sessions;
+
+      const callback_t m_resume;
+    };
+
+  }} // namespace cocaine::engine
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef COCAINE_GENERIC_WORKER_METRICS_HPP
+#define COCAINE_GENERIC_WORKER_METRICS_HPP
+
+#include <cocaine/common.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include "reactor.hpp"
+
+namespace cocaine { namespace engine {
+
+    // Log-linear histogram in the spirit of HdrHistogram: every power of two
+    // is split into 16 linear buckets, which keeps the relative error under
+    // 7% across the whole range. Recording is wait-free.
+    class histogram_t:
+    public boost::noncopyable
+    {
+    public:
+      histogram_t();
+
+      void
+      record(uint64_t value);
+
+      uint64_t
+      count() const {
+        return m_count.load(std::memory_order_relaxed);
+      }
+
+      // Approximate value at the given quantile, in [0, 1].
+      uint64_t
+      quantile(double q) const;
+
+      Json::Value
+      snapshot() const;
+
+    private:
+      static const unsigned precision = 4;
+      static const unsigned magnitudes = 40;
+      static const size_t buckets = (magnitudes - precision + 1) << precision;
+
+      static
+      size_t
+      bucket_of(uint64_t value);
+
+      static
+      uint64_t
+      value_of(size_t bucket);
+
+    private:
+      std::atomic<uint64_t> m_buckets[buckets];
+
+      std::atomic<uint64_t> m_count,
+                            m_sum,
+                            m_max;
+    };
+
+    // Durations of the consecutive startup phases, each one measured from
+    // the end of the previous one, or from the construction for the first.
+    class timeline_t {
+    public:
+      typedef std::chrono::steady_clock clock_type;
+
+      timeline_t();
+
+      void
+      mark(const std::string& phase);
+
+      // In milliseconds.
+      double
+      total() const;
+
+      // Phases as "name=0.123ms" separated by spaces, for the logs.
+      std::string
+      format() const;
+
+      Json::Value
+      snapshot() const;
+
+    private:
+      clock_type::time_point m_started,
+                             m_last;
+
+      std::vector<std::pair<std::string, double>> m_phases;
+    };
+
+    // Event rate, exponentially smoothed over roughly a minute.
+    class meter_t {
+    public:
+      meter_t();
+
+      // Folds in the events counted since the previous tick.
+      void
+      tick(uint64_t total,
+           double now);
+
+      double
+      rate() const {
+        return m_rate;
+      }
+
+    private:
+      uint64_t m_total;
+      double m_last,
+             m_rate;
+    };
+
+    struct metrics_t:
+      public boost::noncopyable
+    {
+      typedef std::chrono::steady_clock clock_type;
+
+      metrics_t();
+
+      // Invoke-to-choke latency histogram for the event, in microseconds.
+      // Histograms are never removed, so the reference might be kept.
+      histogram_t&
+      latency(const std::string& event);
+
+      void
+      tick(double now);
+
+      Json::Value
+      snapshot() const;
+
+      std::atomic<uint64_t> invokes,
+                            chunks_in,
+                            bytes_in,
+                            chunks_out,
+                            bytes_out;
+
+      // Sessions started by a shard other than the one they were queued to.
+      std::atomic<uint64_t> steals;
+
+      // Sessions dropped after their idle or absolute timeout.
+      std::atomic<uint64_t> reaped;
+
+      // Duration of the worker loop iterations, from one prepare to the next
+      // and waiting for I/O included, in microseconds, see loop_monitor_t.
+      histogram_t iteration_time;
+
+      meter_t invoke_rate;
+
+    private:
+      const clock_type::time_point m_started;
+
+      typedef std::map<
+        std::string,
+        std::unique_ptr<histogram_t>
+      > histogram_map_t;
+
+      // NOTE: The executors might live on threads of their own.
+      mutable std::mutex m_mutex;
+      histogram_map_t m_latencies;
+    };
+
+    // Serves a JSON snapshot to every client connecting to a local UNIX
+    // socket, so the workers can be scraped without touching the engine.
+    class metrics_socket_t:
+    public boost::noncopyable
+    {
+    public:
+      typedef std::function<std::string()> snapshot_t;
+
+      metrics_socket_t(reactor_t& reactor,
+                       const std::string& path,
+                       snapshot_t snapshot);
+
+      ~metrics_socket_t();
+
+    private:
+      void
+      on_accept();
+
+    private:
+      const std::string m_path;
+      const snapshot_t m_snapshot;
+
+      int m_fd;
+
+      std::unique_ptr<io_watcher_t> m_watcher;
+    };
+
+    inline
+    uint64_t
+    microseconds(metrics_t::clock_type::duration duration) {
+      return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    }
+
+  }} // namespace cocaine::engine
+
+#endif
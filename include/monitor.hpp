@@ -0,0 +1,90 @@
+#ifndef COCAINE_GENERIC_WORKER_MONITOR_HPP
+#define COCAINE_GENERIC_WORKER_MONITOR_HPP
+
+#include <cocaine/common.hpp>
+
+#include <chrono>
+
+#include <msgpack.hpp>
+
+#include "metrics.hpp"
+#include "reactor.hpp"
+
+namespace cocaine { namespace engine {
+
+    // Measures how busy the event loop is. Everything between waking up
+    // from I/O and going back to it counts as busy, and the longest such
+    // stretch is the worst delay any event could have seen, i.e. the lag.
+    class loop_monitor_t:
+    public boost::noncopyable
+    {
+    public:
+      typedef std::chrono::steady_clock clock_type;
+
+      struct sample_t {
+        // The longest busy stretch, in seconds.
+        double lag;
+
+        // The busy fraction of the wall time, in [0, 1].
+        double busy;
+      };
+
+      // Records the duration of every iteration into the histogram, if any.
+      explicit
+      loop_monitor_t(reactor_t& reactor,
+                     histogram_t * iterations = nullptr);
+
+      // Returns the figures since the previous sample and starts over.
+      sample_t
+      sample();
+
+    private:
+      void
+      on_prepare();
+
+      void
+      on_check();
+
+    private:
+      histogram_t * const m_iterations;
+
+      std::unique_ptr<prepare_watcher_t> m_prepare;
+      std::unique_ptr<check_watcher_t> m_check;
+
+      clock_type::time_point m_started,
+                             m_woken,
+                             m_prepared;
+
+      clock_type::duration m_busy,
+                           m_longest;
+    };
+
+    // Load record published with every heartbeat, so that the engine can
+    // dispatch to the least loaded worker. Packed as a positional array.
+    struct load_t {
+      // Loop lag in seconds and busy ratio, see above.
+      double lag;
+      double busy;
+
+      // Open sessions.
+      uint64_t sessions;
+
+      // Bytes waiting in the outgoing queue.
+      uint64_t outbound;
+
+      // Invokes per second, smoothed over about a minute.
+      double invoke_rate;
+
+      // Resident set size in bytes.
+      uint64_t rss;
+
+      MSGPACK_DEFINE(lag, busy, sessions, outbound, invoke_rate, rss);
+    };
+
+    // Resident set size of the current process in bytes, zero if unknown.
+    uint64_t
+    resident_size();
+
+  }} // namespace cocaine::engine
+
+#endif
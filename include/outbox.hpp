@@ -0,0 +1,166 @@
+#ifndef COCAINE_GENERIC_WORKER_OUTBOX_HPP
+#define COCAINE_GENERIC_WORKER_OUTBOX_HPP
+
+#include <cocaine/common.hpp>
+#include <cocaine/asio.hpp>
+#include <cocaine/rpc.hpp>
+
+#include <cocaine/traits/unique_id.hpp>
+
+#include <deque>
+
+#include "flow.hpp"
+#include "transport.hpp"
+
+namespace cocaine { namespace engine {
+
+    // Optional interface implemented by the worker upstreams, following the
+    // Node.js writable stream contract: once writable() turns false, the
+    // sandbox should hold off pushing until the drain callback is called.
+    // Whatever is pushed in the meantime is still queued, not lost.
+    class writable_stream_t {
+    public:
+      typedef std::function<void()> callback_t;
+
+      virtual
+      ~writable_stream_t() {
+        // Empty.
+      }
+
+      virtual
+      bool
+      writable() const = 0;
+
+      // The callback is called once, right away if the stream is writable.
+      virtual
+      void
+      on_drain(callback_t callback) = 0;
+    };
+
+    // Outgoing messages the engine channel couldn't take right away. Every
+    // send is non-blocking, and once the channel would block, the message
+    // and everything after it are queued in order until the channel becomes
+    // writable again, see flush().
+    class outbox_t:
+    public boost::noncopyable
+    {
+    public:
+      typedef std::function<void()> callback_t;
+
+      // The queue is congested while it holds at least the given number of
+      // bytes, the callback is called once it drops to the low watermark.
+      outbox_t(io::unique_channel_t& channel,
+               size_t high,
+               size_t low,
+               callback_t drain);
+
+      template<class Event, typename... Args>
+      void
+      send(const Args&... args);
+
+      // Appends a frame to the current message, taking its contents, and
+      // sends the message once its last frame is appended.
+      void
+      append(zmq::message_t& frame,
+             bool more);
+
+      template<class T>
+      void
+      append(const T& value,
+             bool more);
+
+      // Sends as much of the queue as the channel takes without blocking,
+      // returns true once the queue is empty.
+      bool
+      flush();
+
+      // Sends the whole queue, blocking if needed.
+      void
+      drain();
+
+      bool
+      empty() const {
+        return m_frames.empty();
+      }
+
+      bool
+      congested() const {
+        return m_bytes.congested();
+      }
+
+      // Bytes waiting in the queue.
+      size_t
+      bytes() const {
+        return m_bytes.inflight();
+      }
+
+      // Messages which would have blocked and have been queued instead.
+      uint64_t
+      stalls() const {
+        return m_stalls;
+      }
+
+    private:
+      template<class T, typename... Args>
+      void
+      pack(const T& head,
+           const Args&... tail);
+
+      void
+      pack() {
+        // Empty.
+      }
+
+      // Returns true if the queue is no longer congested.
+      bool
+      pop();
+
+    private:
+      io::unique_channel_t& m_channel;
+
+      struct frame_t {
+        zmq::message_t message;
+
+        // ZeroMQ empties the message once it's sent.
+        size_t size;
+        bool more;
+      };
+
+      std::deque<frame_t> m_frames;
+
+      watermark_t m_bytes;
+      uint64_t m_stalls;
+
+      const callback_t m_drain;
+    };
+
+    template<class Event, typename... Args>
+    void
+    outbox_t::send(const Args&... args) {
+      append(static_cast<int>(io::event_traits<Event>::id), sizeof...(args) != 0);
+      pack(args...);
+    }
+
+    template<class T>
+    void
+    outbox_t::append(const T& value,
+                     bool more)
+    {
+      zmq::message_t frame;
+
+      pack_frame(frame, value);
+      append(frame, more);
+    }
+
+    template<class T, typename... Args>
+    void
+    outbox_t::pack(const T& head,
+                   const Args&... tail)
+    {
+      append(head, sizeof...(tail) != 0);
+      pack(tail...);
+    }
+
+  }} // namespace cocaine::engine
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef COCAINE_GENERIC_WORKER_POOL_HPP
+#define COCAINE_GENERIC_WORKER_POOL_HPP
+
+#include <cocaine/common.hpp>
+
+#include <limits>
+
+namespace cocaine { namespace engine {
+
+    // Small object pool with a free list per 16-byte size class. Blocks are
+    // carved out of slabs and never returned to the heap until the pool is
+    // destroyed, so a steady stream of same-sized objects is served without
+    // touching the general purpose allocator at all.
+    //
+    // NOTE: The pool is not thread-safe, and it must outlive every block.
+    class pool_t:
+    public boost::noncopyable
+    {
+    public:
+      explicit
+      pool_t(size_t slab_size = 64);
+
+      ~pool_t();
+
+      void*
+      allocate(size_t size);
+
+      void
+      deallocate(void * block,
+                 size_t size);
+
+      // Allocations served from a free list.
+      uint64_t
+      hits() const {
+        return m_hits;
+      }
+
+      // Allocations which had to go to the heap.
+      uint64_t
+      misses() const {
+        return m_misses;
+      }
+
+    private:
+      struct node_t {
+        node_t * next;
+      };
+
+      static const size_t granularity = 16;
+      static const size_t classes = 16;
+
+      const size_t m_slab_size;
+
+      node_t * m_free[classes];
+      std::vector<void*> m_slabs;
+
+      uint64_t m_hits,
+               m_misses;
+    };
+
+    // Standard allocator interface over a pool, for boost::allocate_shared().
+    template<class T>
+    class pool_allocator_t {
+    public:
+      typedef T value_type;
+      typedef T* pointer;
+      typedef const T* const_pointer;
+      typedef T& reference;
+      typedef const T& const_reference;
+      typedef size_t size_type;
+      typedef ptrdiff_t difference_type;
+
+      template<class U>
+      struct rebind {
+        typedef pool_allocator_t<U> other;
+      };
+
+      explicit
+      pool_allocator_t(pool_t& pool):
+        m_pool(&pool)
+      { }
+
+      template<class U>
+      pool_allocator_t(const pool_allocator_t<U>& other):
+        m_pool(other.m_pool)
+      { }
+
+      pointer
+      allocate(size_type n,
+               const void * = 0)
+      {
+        return static_cast<pointer>(m_pool->allocate(n * sizeof(T)));
+      }
+
+      void
+      deallocate(pointer block,
+                 size_type n)
+      {
+        m_pool->deallocate(block, n * sizeof(T));
+      }
+
+      template<class U, typename... Args>
+      void
+      construct(U * block,
+                Args&&... args)
+      {
+        ::new(static_cast<void*>(block)) U(std::forward<Args>(args)...);
+      }
+
+      template<class U>
+      void
+      destroy(U * block) {
+        block->~U();
+      }
+
+      size_type
+      max_size() const {
+        return std::numeric_limits<size_type>::max() / sizeof(T);
+      }
+
+      pointer
+      address(reference value) const {
+        return &value;
+      }
+
+      const_pointer
+      address(const_reference value) const {
+        return &value;
+      }
+
+      template<class U>
+      bool
+      operator==(const pool_allocator_t<U>& other) const {
+        return m_pool == other.m_pool;
+      }
+
+      template<class U>
+      bool
+      operator!=(const pool_allocator_t<U>& other) const {
+        return m_pool != other.m_pool;
+      }
+
+    private:
+      template<class U>
+      friend class pool_allocator_t;
+
+      pool_t * m_pool;
+    };
+
+  }} // namespace cocaine::engine
+
+#endif
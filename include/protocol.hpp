@@ -0,0 +1,192 @@
+#ifndef COCAINE_GENERIC_WORKER_PROTOCOL_HPP
+#define COCAINE_GENERIC_WORKER_PROTOCOL_HPP
+
+#include <cocaine/common.hpp>
+#include <cocaine/rpc.hpp>
+#include <cocaine/unique_id.hpp>
+
+#include <tuple>
+
+#include <zmq.hpp>
+
+#include "shm.hpp"
+
+namespace cocaine { namespace engine {
+
+    // The frames following the message id, as the worker receives them. For
+    // most events these are the event's own arguments, but the chunk payload
+    // is taken as a raw frame, see executor_t::chunk().
+    template<class Event>
+    struct frames_of;
+
+    template<>
+    struct frames_of<io::rpc::heartbeat> {
+      typedef std::tuple<> type;
+    };
+
+    template<>
+    struct frames_of<io::rpc::invoke> {
+      typedef std::tuple<unique_id_t, std::string> type;
+    };
+
+    template<>
+    struct frames_of<io::rpc::chunk> {
+      typedef std::tuple<unique_id_t, zmq::message_t> type;
+    };
+
+    template<>
+    struct frames_of<io::rpc::choke> {
+      typedef std::tuple<unique_id_t> type;
+    };
+
+    template<>
+    struct frames_of<io::rpc::terminate> {
+      typedef std::tuple<> type;
+    };
+
+    template<>
+    struct frames_of<shm::accept> {
+      typedef std::tuple<> type;
+    };
+
+    template<>
+    struct frames_of<shm::chunk> {
+      typedef std::tuple<unique_id_t, uint64_t, uint64_t> type;
+    };
+
+    // Selects the handler overload for the event.
+    template<class Event>
+    struct event_tag { };
+
+    template<class... Events>
+    struct events_t { };
+
+    namespace detail {
+      template<size_t... Indices>
+      struct indices_t { };
+
+      template<size_t N, size_t... Indices>
+      struct make_indices:
+        make_indices<N - 1, N - 1, Indices...>
+      { };
+
+      template<size_t... Indices>
+      struct make_indices<0, Indices...> {
+        typedef indices_t<Indices...> type;
+      };
+
+      template<class... Events>
+      struct max_id;
+
+      template<>
+      struct max_id<> {
+        static const int value = -1;
+      };
+
+      template<class Event, class... Events>
+      struct max_id<Event, Events...> {
+        static const int value = static_cast<int>(io::event_traits<Event>::id) > max_id<Events...>::value ?
+          static_cast<int>(io::event_traits<Event>::id) :
+          max_id<Events...>::value;
+      };
+
+      // Decoded frames of a single event, kept across the messages so that
+      // nothing is constructed per message and the strings keep their room.
+      template<class Event>
+      struct slot_t {
+        typename frames_of<Event>::type frames;
+      };
+    }
+
+    template<class Handler, class Channel, class Events>
+    class protocol_t;
+
+    // Dispatch table indexed by the message id, generated from the list of
+    // the events. The frames of a message are received right into the slot
+    // of its event, and the handler is called with them as
+    //
+    //   handler.handle(event_tag<Event>(), frames...)
+    //
+    // NOTE: Handlers may take the contents of the frames, but shouldn't keep
+    // references to them, as they are overwritten by the next message.
+    template<class Handler, class Channel, class... Events>
+    class protocol_t<Handler, Channel, events_t<Events...>>:
+      public boost::noncopyable,
+      private detail::slot_t<Events>...
+    {
+    public:
+      explicit
+      protocol_t(Handler& handler);
+
+      // Receives the rest of the message and handles it. Returns false for
+      // an unknown or malformed message, which is left to the caller.
+      bool
+      dispatch(int id,
+               Channel& channel)
+      {
+        if(__builtin_expect(id < 0 || id >= size || !m_table[id], 0)) {
+          return false;
+        }
+
+        return (this->*m_table[id])(channel);
+      }
+
+    private:
+      template<class Event>
+      bool
+      receive(Channel& channel) {
+        return unpack<Event>(
+          channel,
+          static_cast<detail::slot_t<Event>&>(*this).frames,
+          typename detail::make_indices<std::tuple_size<typename frames_of<Event>::type>::value>::type()
+        );
+      }
+
+      template<class Event, class Frames, size_t... Indices>
+      bool
+      unpack(Channel& channel,
+             Frames& frames,
+             detail::indices_t<Indices...>)
+      {
+        // NOTE: The list is evaluated in order, so the frames are received in
+        // order as well.
+        const bool received[] = { true, channel.recv(std::get<Indices>(frames))... };
+
+        for(size_t i = 0; i < sizeof(received) / sizeof(received[0]); ++i) {
+          if(!received[i]) {
+            return false;
+          }
+        }
+
+        m_handler.handle(event_tag<Event>(), std::get<Indices>(frames)...);
+
+        return true;
+      }
+
+    private:
+      typedef bool (protocol_t::*receiver_t)(Channel&);
+
+      static const int size = detail::max_id<Events...>::value + 1;
+
+      Handler& m_handler;
+      receiver_t m_table[size];
+    };
+
+    template<class Handler, class Channel, class... Events>
+    protocol_t<Handler, Channel, events_t<Events...>>::protocol_t(Handler& handler):
+      m_handler(handler)
+    {
+      for(int id = 0; id < size; ++id) {
+        m_table[id] = nullptr;
+      }
+
+      const int expand[] = {
+        0, (m_table[io::event_traits<Events>::id] = &protocol_t::template receive<Events>, 0)...
+      };
+
+      (void)expand;
+    }
+
+  }} // namespace cocaine::engine
+
+#endif
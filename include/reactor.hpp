@@ -0,0 +1,330 @@
+#ifndef COCAINE_GENERIC_WORKER_REACTOR_HPP
+#define COCAINE_GENERIC_WORKER_REACTOR_HPP
+
+#include <cocaine/common.hpp>
+#include <cocaine/asio.hpp>
+
+#include <functional>
+
+#include <nodejs/uv.h>
+
+// NOTE: The libuv backend is written against the libuv 1.x API. Node.js
+// releases bundling libuv 0.x get a build with the libev backend only.
+#if defined(UV_VERSION_MAJOR) && UV_VERSION_MAJOR >= 1
+#define COCAINE_WORKER_HAVE_LIBUV
+
+// NOTE: A libuv loop can only be carried over a fork since libuv 1.12.
+#if UV_VERSION_MAJOR > 1 || UV_VERSION_MINOR >= 12
+#define COCAINE_WORKER_HAVE_LOOP_FORK
+#endif
+#else
+// NOTE: Older releases have no signal handles, and the watchers only need
+// the pointer type to be declared.
+struct uv_signal_s;
+typedef struct uv_signal_s uv_signal_t;
+#endif
+
+namespace cocaine { namespace engine {
+
+    // The worker can either own a libev loop, or share the libuv loop with
+    // the Node.js runtime hosted by the sandbox. The watchers below hide the
+    // difference, so the worker logic is written once for both backends.
+
+    class reactor_t:
+    public boost::noncopyable
+    {
+    public:
+      enum class backend_t: int {
+        libev,
+          libuv
+          };
+
+      // The primary reactor runs on the default loop, which is shared with
+      // the Node.js runtime. Any other one gets a private loop, so that it
+      // can run on a thread of its own.
+      explicit
+      reactor_t(backend_t backend,
+                bool primary = true);
+
+      ~reactor_t();
+
+      backend_t
+      backend() const {
+        return m_backend;
+      }
+
+      void
+      run();
+
+      void
+      stop();
+
+      // Has to be called in a forked child before the loop is used there,
+      // so that it doesn't share the kernel state with the parent's one.
+      // Throws for a libuv loop if libuv can't do that, see zygote_t.
+      void
+      fork();
+
+      // Loop time in seconds, cached at the start of the current iteration.
+      double
+      now() const;
+
+      ev::loop_ref
+      ev_loop() const {
+        return m_ev_loop;
+      }
+
+      uv_loop_t*
+      uv_loop() const {
+        return m_uv_loop;
+      }
+
+    private:
+      const backend_t m_backend;
+      const bool m_primary;
+
+      ev::loop_ref m_ev_loop;
+      uv_loop_t * const m_uv_loop;
+    };
+
+    typedef std::function<void()> callback_t;
+
+    // Called with a description of the failure.
+    typedef std::function<void(const std::string&)> error_callback_t;
+
+    // Fires when the file descriptor becomes readable.
+    class io_watcher_t:
+    public boost::noncopyable
+    {
+    public:
+      // Once polling the descriptor fails, the watcher stops and reports it
+      // to the error callback, or stops the reactor if there's none.
+      io_watcher_t(reactor_t& reactor,
+                   callback_t callback,
+                   error_callback_t error = error_callback_t());
+
+      ~io_watcher_t();
+
+      void
+      start(int fd);
+
+      void
+      stop();
+
+    private:
+      void
+      on_ev_event(ev::io&, int);
+
+      static
+      void
+      on_uv_event(uv_poll_t* handle, int status, int events);
+
+    private:
+      reactor_t& m_reactor;
+      const callback_t m_callback;
+      const error_callback_t m_error;
+
+      ev::io m_ev_watcher;
+
+      uv_poll_t* m_uv_poll_handle;
+    };
+
+    // Fires on every loop iteration while active and keeps the loop from
+    // blocking for I/O. Pending timers and I/O are serviced in between.
+    class idle_watcher_t:
+    public boost::noncopyable
+    {
+    public:
+      idle_watcher_t(reactor_t& reactor,
+                     callback_t callback);
+
+      ~idle_watcher_t();
+
+      // Both are idempotent.
+      void
+      start();
+
+      void
+      stop();
+
+    private:
+      void
+      on_ev_event(ev::idle&, int);
+
+      static
+      void
+      on_uv_event(uv_idle_t* handle);
+
+    private:
+      reactor_t& m_reactor;
+      const callback_t m_callback;
+
+      ev::idle m_ev_watcher;
+      uv_idle_t* m_uv_handle;
+    };
+
+    // Fires once per loop iteration, right before the loop blocks for I/O.
+    class prepare_watcher_t:
+    public boost::noncopyable
+    {
+    public:
+      prepare_watcher_t(reactor_t& reactor,
+                        callback_t callback);
+
+      ~prepare_watcher_t();
+
+      // Both are idempotent.
+      void
+      start();
+
+      void
+      stop();
+
+    private:
+      void
+      on_ev_event(ev::prepare&, int);
+
+      static
+      void
+      on_uv_event(uv_prepare_t* handle);
+
+    private:
+      reactor_t& m_reactor;
+      const callback_t m_callback;
+
+      ev::prepare m_ev_watcher;
+      uv_prepare_t* m_uv_handle;
+    };
+
+    // Fires once per loop iteration, right after the loop wakes up from I/O.
+    class check_watcher_t:
+    public boost::noncopyable
+    {
+    public:
+      check_watcher_t(reactor_t& reactor,
+                        callback_t callback);
+
+      ~check_watcher_t();
+
+      // Both are idempotent.
+      void
+      start();
+
+      void
+      stop();
+
+    private:
+      void
+      on_ev_event(ev::check&, int);
+
+      static
+      void
+      on_uv_event(uv_check_t* handle);
+
+    private:
+      reactor_t& m_reactor;
+      const callback_t m_callback;
+
+      ev::check m_ev_watcher;
+      uv_check_t* m_uv_handle;
+    };
+
+    // Fires on the loop thread after send() has been called from any other
+    // thread. Sends made before the callback gets to run are coalesced.
+    class async_watcher_t:
+    public boost::noncopyable
+    {
+    public:
+      async_watcher_t(reactor_t& reactor,
+                      callback_t callback);
+
+      ~async_watcher_t();
+
+      // Thread-safe.
+      void
+      send();
+
+    private:
+      void
+      on_ev_event(ev::async&, int);
+
+      static
+      void
+      on_uv_event(uv_async_t* handle);
+
+    private:
+      reactor_t& m_reactor;
+      const callback_t m_callback;
+
+      ev::async m_ev_watcher;
+      uv_async_t* m_uv_handle;
+    };
+
+    // Fires on the loop thread after the process has received the signal.
+    class signal_watcher_t:
+    public boost::noncopyable
+    {
+    public:
+      signal_watcher_t(reactor_t& reactor,
+                       callback_t callback);
+
+      ~signal_watcher_t();
+
+      void
+      start(int signum);
+
+      void
+      stop();
+
+    private:
+      void
+      on_ev_event(ev::sig&, int);
+
+      static
+      void
+      on_uv_event(uv_signal_t* handle, int signum);
+
+    private:
+      reactor_t& m_reactor;
+      const callback_t m_callback;
+
+      ev::sig m_ev_watcher;
+      uv_signal_t* m_uv_handle;
+    };
+
+    class timer_watcher_t:
+    public boost::noncopyable
+    {
+    public:
+      timer_watcher_t(reactor_t& reactor,
+                      callback_t callback);
+
+      ~timer_watcher_t();
+
+      // Both intervals are in seconds, a zero repeat makes a one-shot timer.
+      void
+      start(double after,
+            double repeat = 0.0);
+
+      void
+      stop();
+
+    private:
+      void
+      on_ev_event(ev::timer&, int);
+
+      static
+      void
+      on_uv_event(uv_timer_t* handle);
+
+    private:
+      reactor_t& m_reactor;
+      const callback_t m_callback;
+
+      ev::timer m_ev_watcher;
+      uv_timer_t* m_uv_handle;
+    };
+
+  }} // namespace cocaine::engine
+
+#endif
@@ -0,0 +1,271 @@
+#ifndef COCAINE_GENERIC_WORKER_SESSION_MAP_HPP
+#define COCAINE_GENERIC_WORKER_SESSION_MAP_HPP
+
+#include <cocaine/common.hpp>
+#include <cocaine/unique_id.hpp>
+
+#include <iterator>
+#include <utility>
+
+namespace cocaine { namespace engine {
+
+    // Open-addressing hash table keyed by session ids. Values are stored
+    // inline, probing walks a dense array of hashes and only touches a slot
+    // on a full hash match. Erasure shifts the following probe run back,
+    // so there are no tombstones and lookups never degrade over time.
+    //
+    // Iterators and references are invalidated by any insertion or erasure.
+    // The erased value is destroyed only once the table is consistent again,
+    // so its destructor may use the table.
+    template<class Value>
+    class session_map_t {
+    public:
+      struct value_type {
+        value_type():
+          first(uninitialized)
+        { }
+
+        unique_id_t first;
+        Value second;
+      };
+
+      class iterator:
+        public std::iterator<std::forward_iterator_tag, value_type>
+      {
+      public:
+        value_type&
+        operator*() const {
+          return m_map->m_items[m_index];
+        }
+
+        value_type*
+        operator->() const {
+          return &m_map->m_items[m_index];
+        }
+
+        iterator&
+        operator++() {
+          m_index = m_map->skip(m_index + 1);
+          return *this;
+        }
+
+        bool
+        operator==(const iterator& other) const {
+          return m_index == other.m_index;
+        }
+
+        bool
+        operator!=(const iterator& other) const {
+          return m_index != other.m_index;
+        }
+
+      private:
+        friend class session_map_t;
+
+        iterator(session_map_t * map,
+                 size_t index):
+          m_map(map),
+          m_index(index)
+        { }
+
+      private:
+        session_map_t * m_map;
+        size_t m_index;
+      };
+
+    public:
+      explicit
+      session_map_t(size_t capacity = 0):
+        m_size(0)
+      {
+        rehash(slots_for(capacity));
+      }
+
+      iterator
+      begin() {
+        return iterator(this, skip(0));
+      }
+
+      iterator
+      end() {
+        return iterator(this, m_hashes.size());
+      }
+
+      size_t
+      size() const {
+        return m_size;
+      }
+
+      bool
+      empty() const {
+        return m_size == 0;
+      }
+
+      // Makes room for the given number of sessions without rehashing.
+      void
+      reserve(size_t capacity) {
+        const size_t slots = slots_for(capacity);
+
+        if(slots > m_hashes.size()) {
+          rehash(slots);
+        }
+      }
+
+      iterator
+      find(const unique_id_t& key) {
+        const size_t hash = hash_of(key);
+        const size_t mask = m_hashes.size() - 1;
+
+        for(size_t index = hash & mask; m_hashes[index]; index = (index + 1) & mask) {
+          if(m_hashes[index] == hash && m_items[index].first == key) {
+            return iterator(this, index);
+          }
+        }
+
+        return end();
+      }
+
+      std::pair<iterator, bool>
+      emplace(const unique_id_t& key,
+              const Value& value)
+      {
+        iterator it(find(key));
+
+        if(it != end()) {
+          return std::make_pair(it, false);
+        }
+
+        if((m_size + 1) * 4 > m_hashes.size() * 3) {
+          rehash(m_hashes.size() * 2);
+        }
+
+        const size_t index = insert(hash_of(key), key, Value(value));
+
+        return std::make_pair(iterator(this, index), true);
+      }
+
+      void
+      erase(iterator it) {
+        const size_t mask = m_hashes.size() - 1;
+
+        size_t hole = it.m_index;
+
+        // NOTE: Destroying a session might close its upstream, which looks
+        // the session up again, so that has to wait until the shift is done.
+        Value erased;
+
+        std::swap(erased, m_items[hole].second);
+
+        // NOTE: Pull every following element of the probe run back into the
+        // hole, unless its home slot lies cyclically within (hole, index].
+        for(size_t index = (hole + 1) & mask; m_hashes[index]; index = (index + 1) & mask) {
+          const size_t home = m_hashes[index] & mask;
+
+          const bool stays = hole <= index ?
+            hole < home && home <= index :
+            hole < home || home <= index;
+
+          if(stays) {
+            continue;
+          }
+
+          m_hashes[hole] = m_hashes[index];
+          m_items[hole].first = m_items[index].first;
+          m_items[hole].second = std::move(m_items[index].second);
+
+          hole = index;
+        }
+
+        m_hashes[hole] = 0;
+        m_items[hole].second = Value();
+
+        --m_size;
+      }
+
+    private:
+      static
+      size_t
+      hash_of(const unique_id_t& key) {
+        // NOTE: Mix the bits, so that masking the low ones is good enough to
+        // pick a slot. Zero marks empty slots, so it's never a valid hash.
+        uint64_t hash = hash_value(key);
+
+        hash ^= hash >> 33;
+        hash *= 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 33;
+        hash *= 0xC4CEB9FE1A85EC53ULL;
+        hash ^= hash >> 33;
+
+        return hash ? static_cast<size_t>(hash) : 1;
+      }
+
+      static
+      size_t
+      slots_for(size_t capacity) {
+        size_t slots = 16;
+
+        while(slots * 3 < capacity * 4) {
+          slots *= 2;
+        }
+
+        return slots;
+      }
+
+      size_t
+      skip(size_t index) const {
+        while(index < m_hashes.size() && !m_hashes[index]) {
+          ++index;
+        }
+
+        return index;
+      }
+
+      size_t
+      insert(size_t hash,
+             const unique_id_t& key,
+             Value&& value)
+      {
+        const size_t mask = m_hashes.size() - 1;
+
+        size_t index = hash & mask;
+
+        while(m_hashes[index]) {
+          index = (index + 1) & mask;
+        }
+
+        m_hashes[index] = hash;
+        m_items[index].first = key;
+        m_items[index].second = std::move(value);
+
+        ++m_size;
+
+        return index;
+      }
+
+      void
+      rehash(size_t slots) {
+        std::vector<size_t> hashes(slots, 0);
+        std::vector<value_type> items(slots);
+
+        hashes.swap(m_hashes);
+        items.swap(m_items);
+
+        m_size = 0;
+
+        for(size_t index = 0; index < hashes.size(); ++index) {
+          if(hashes[index]) {
+            insert(hashes[index], items[index].first, std::move(items[index].second));
+          }
+        }
+      }
+
+    private:
+      std::vector<size_t> m_hashes;
+      std::vector<value_type> m_items;
+
+      size_t m_size;
+    };
+
+  }} // namespace cocaine::engine
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef COCAINE_GENERIC_WORKER_SETTINGS_HPP
+#define COCAINE_GENERIC_WORKER_SETTINGS_HPP
+
+#include "reactor.hpp"
+#include "trace.hpp"
+
+namespace cocaine { namespace engine {
+
+    // Worker tuning knobs, read from the app profile. Every knob is optional
+    // and falls back to the behavior of a plain libev worker.
+
+    struct settings_t {
+      explicit
+      settings_t(const Json::Value& profile);
+
+      // Profile key: "event-loop", either "libev" or "libuv".
+      reactor_t::backend_t backend;
+
+      // Profile keys: "io-bulk-size", "io-bulk-min" and "io-bulk-max" bound
+      // the number of messages handled per drain, "io-bulk-time" limits its
+      // duration in seconds. See io_budget_t.
+      unsigned long io_bulk_size,
+                    io_bulk_min,
+                    io_bulk_max;
+
+      double io_bulk_time;
+
+      // Profile key: "heartbeat-interval", in seconds. A shorter interval
+      // lets the engine notice a stuck loop sooner.
+      double heartbeat_interval;
+
+      // Profile key: "heartbeat-load", whether heartbeats carry a load record,
+      // see load_t. Off by default, as older engines don't expect it.
+      bool heartbeat_load;
+
+      // Profile key: "chunk-coalesce-size", the size in bytes below which
+      // outgoing chunks are merged, zero disables coalescing.
+      size_t chunk_coalesce_size;
+
+      // Profile key: "sandbox-batching", whether the messages are handed to
+      // the sandbox once per loop iteration if it can take them in batches,
+      // see batch_sandbox_t.
+      bool sandbox_batching;
+
+      // Profile keys: "shm-threshold", the size in bytes from which chunk
+      // frames go through shared memory if the engine supports it, zero
+      // disables it, and "shm-size", the size of the ring for either
+      // direction. See side_channel_t.
+      size_t shm_threshold,
+             shm_size;
+
+      // Profile key: "session-capacity", the number of concurrent sessions
+      // the session table is sized for upfront.
+      size_t session_capacity;
+
+      // Profile keys: "session-idle-timeout" and "session-timeout", the time
+      // in seconds a session may go without a chunk either way, and may last
+      // at all, before it's failed and dropped, zero is unlimited.
+      double session_idle_timeout,
+             session_timeout;
+
+      // Profile key: "drain-timeout", the time in seconds the worker keeps
+      // serving its sessions after the engine has asked it to terminate,
+      // zero terminates at once. It should be kept below the termination
+      // timeout, after which the engine kills the worker anyway.
+      double drain_timeout;
+
+      // Profile keys: "session-inflight-high" and "worker-inflight-high", the
+      // number of received chunk bytes the sandbox may hold on to per session
+      // and per worker before the worker stops reading, zero is unlimited.
+      // Reading resumes once they drop to "session-inflight-low" and
+      // "worker-inflight-low", which default to a half of the high marks.
+      size_t session_inflight_high,
+             session_inflight_low,
+             worker_inflight_high,
+             worker_inflight_low;
+
+      // Profile keys: "outbound-queue-high" and "outbound-queue-low", the
+      // number of queued outgoing bytes at which upstreams stop being
+      // writable, and at which they are told to resume, see outbox_t.
+      size_t outbound_queue_high,
+             outbound_queue_low;
+
+      // Profile key: "threads", the number of sandbox instances, each on a
+      // thread of its own. With a single one, it runs right on the thread
+      // which reads the channel. See shard_t.
+      size_t threads;
+
+      // Profile key: "thread-queue-size", the capacity of the rings between
+      // the channel thread and each of the sandbox threads.
+      size_t thread_queue_size;
+
+      // Profile key: "zygote", whether the workers ask a zygote to fork them
+      // with the app already loaded, see zygote_t. Off by default.
+      bool zygote;
+
+      // Profile key: "zygote-preload", whether a zygote loads the sandbox
+      // before forking the workers, see zygote_t. On by default, but only
+      // ever done in the single-threaded mode. Otherwise only the manifest,
+      // the profile and the settings are loaded ahead of time.
+      bool zygote_preload;
+
+      // Profile key: "metrics", whether to serve metric snapshots on a UNIX
+      // socket named "<app>.<uuid>.metrics" in the runtime directory.
+      bool metrics;
+
+      // Profile keys: "trace", one of "off", "log" or "ring", and the number
+      // of records kept in the ring, "trace-ring-size".
+      tracer_t::mode_t trace;
+      size_t trace_ring_size;
+    };
+
+  }} // namespace cocaine::engine
+
+#endif
@@ -0,0 +1,266 @@
+#ifndef COCAINE_GENERIC_WORKER_SHARD_HPP
+#define COCAINE_GENERIC_WORKER_SHARD_HPP
+
+#include <cocaine/common.hpp>
+#include <cocaine/unique_id.hpp>
+
+#include <deque>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "dispatcher.hpp"
+#include "executor.hpp"
+#include "outbox.hpp"
+#include "spsc.hpp"
+
+namespace cocaine { namespace engine {
+
+    // A sandbox instance with an executor and a loop on a thread of its own.
+    // The worker thread, which alone reads and writes the engine channel,
+    // talks to it through a pair of rings: session commands go in, and the
+    // outgoing messages come back whole. New sessions are queued with the
+    // dispatcher instead, so that the other shards could take them over.
+    //
+    // NOTE: Unless noted otherwise, methods are called on the worker thread.
+    class shard_t:
+      public transport_t,
+      public boost::noncopyable
+    {
+    public:
+      typedef std::function<std::unique_ptr<api::sandbox_t>()> factory_t;
+
+      // Starts the thread and waits for it to create the sandbox, failing
+      // if creating it has failed. The callback is called from the thread
+      // whenever the worker thread has to look at the shard again.
+      shard_t(const settings_t& settings,
+              metrics_t& metrics,
+              dispatcher_t& dispatcher,
+              size_t index,
+              size_t shares,
+              factory_t factory,
+              callback_t notify,
+              side_channel_t * side);
+
+      // Stops the thread, dropping whatever is still queued.
+      ~shard_t();
+
+      void
+      invoke(const boost::shared_ptr<pending_t>& session);
+
+      // Messages for the sessions the shard has started, see dispatcher_t.
+
+      // Takes the contents of the frame.
+      void
+      chunk(const unique_id_t& session_id,
+            zmq::message_t& frame);
+
+      void
+      choke(const unique_id_t& session_id);
+
+      // Hands over the commands queued since the last commit.
+      void
+      commit();
+
+      // Moves the outgoing messages into the outbox, until it's congested,
+      // along with the sessions dropped by the reaper.
+      void
+      collect(outbox_t& outbox,
+              std::vector<unique_id_t>& expired);
+
+      // Asks the shard to report back once all of its sessions are closed,
+      // see retired().
+      void
+      retire();
+
+      bool
+      retired() const {
+        return m_retired;
+      }
+
+      // Asks the shard to fail its open sessions, once the worker has given
+      // up on waiting for them, see executor_t::abort().
+      void
+      abort();
+
+      // Asks the shard to look for sessions to steal, unless it's got some
+      // queued sessions of its own.
+      void
+      poke();
+
+      // Whether the shard can't take any more commands for now.
+      bool
+      congested() const {
+        return !m_overflow.empty() || m_congested.load(std::memory_order_acquire);
+      }
+
+      // Load figures, as of the last batch of commands.
+
+      size_t
+      sessions() const {
+        return m_sessions.load(std::memory_order_relaxed);
+      }
+
+      size_t
+      inflight() const {
+        return m_inflight.load(std::memory_order_relaxed);
+      }
+
+      size_t
+      open() const {
+        return m_open.load(std::memory_order_relaxed);
+      }
+
+      uint64_t
+      pool_hits() const {
+        return m_pool_hits.load(std::memory_order_relaxed);
+      }
+
+      uint64_t
+      pool_misses() const {
+        return m_pool_misses.load(std::memory_order_relaxed);
+      }
+
+      // Transport, called on the shard thread.
+
+      virtual
+      void
+      send(zmq::message_t * frames,
+           size_t count);
+
+      virtual
+      bool
+      writable() const;
+
+      virtual
+      void
+      expired(const unique_id_t& session_id);
+
+    private:
+      struct command_t {
+        command_t(int type_,
+                  const unique_id_t& session_id_):
+          type(type_),
+          session_id(session_id_)
+        { }
+
+        const int type;
+        const unique_id_t session_id;
+
+        zmq::message_t frame;
+      };
+
+      struct reply_t {
+        reply_t():
+          count(0),
+          session_id(uninitialized),
+          retired(false)
+        { }
+
+        zmq::message_t frames[4];
+        size_t count;
+
+        // Set for the sessions dropped by the reaper, with no frames.
+        unique_id_t session_id;
+
+        // Set once the shard has closed all of its sessions after being
+        // asked to retire, with no frames.
+        bool retired;
+      };
+
+      void
+      post(command_t * command);
+
+      // Shard thread
+
+      void
+      run();
+
+      void
+      reply(reply_t * reply);
+
+      void
+      on_wakeup();
+
+      void
+      on_resume();
+
+      void
+      on_retire();
+
+      // Starts the session and replays whatever has been buffered for it.
+      void
+      start(pending_t& session);
+
+      void
+      publish();
+
+    private:
+      const settings_t& m_settings;
+      metrics_t& m_metrics;
+      dispatcher_t& m_dispatcher;
+
+      const size_t m_index,
+                   m_shares;
+      const factory_t m_factory;
+      const callback_t m_notify;
+
+      side_channel_t * const m_side;
+
+      // Commands, with those which didn't fit into the ring kept aside on
+      // the worker thread until the shard catches up.
+      spsc_queue_t<command_t*> m_commands;
+      std::deque<command_t*> m_overflow;
+      bool m_dirty;
+
+      bool m_retired;
+
+      // Set once the ring has been found full, so the shard notifies the
+      // worker thread when it has made some room.
+      std::atomic<bool> m_overflowed;
+
+      // Outgoing messages, with those which didn't fit into the ring kept
+      // aside on the shard thread.
+      spsc_queue_t<reply_t*> m_replies;
+      std::deque<reply_t*> m_backlog;
+
+      // Set by the shard thread when it needs a wakeup once the worker
+      // thread has collected some of the outgoing messages.
+      mutable std::atomic<bool> m_waiting;
+
+      std::atomic<bool> m_stopping,
+                        m_congested;
+
+      // Set by the shard thread once it has no queued sessions of its own.
+      std::atomic<bool> m_idle;
+
+      std::atomic<size_t> m_sessions,
+                          m_inflight,
+                          m_open;
+
+      std::atomic<uint64_t> m_pool_hits,
+                            m_pool_misses;
+
+      // Shard thread state, created on the thread itself.
+
+      std::unique_ptr<reactor_t> m_reactor;
+      std::unique_ptr<async_watcher_t> m_wakeup;
+      std::unique_ptr<prepare_watcher_t> m_retirer;
+      std::unique_ptr<executor_t> m_executor;
+
+      bool m_retiring;
+
+      // Startup handshake.
+
+      boost::mutex m_mutex;
+      boost::condition_variable m_condition;
+      bool m_started;
+      std::string m_error;
+
+      boost::thread m_thread;
+    };
+
+  }} // namespace cocaine::engine
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef COCAINE_GENERIC_WORKER_SHM_HPP
+#define COCAINE_GENERIC_WORKER_SHM_HPP
+
+#include <cocaine/common.hpp>
+#include <cocaine/rpc.hpp>
+
+#include <atomic>
+#include <mutex>
+
+#include <zmq.hpp>
+
+namespace cocaine { namespace engine {
+
+    // Extensions of the engine protocol for the shared memory side channel,
+    // see side_channel_t. An engine which doesn't know them never accepts the
+    // offer, and everything goes over the channel as usual.
+    namespace shm {
+      // Worker to engine, the segment name and the size of each ring.
+      struct offer;
+
+      // Engine to worker, once the engine has mapped the segment.
+      struct accept;
+
+      // Either way, instead of rpc::chunk: the session, and the offset and
+      // the size of the chunk frame in the sender's ring.
+      struct chunk;
+    }
+
+  }} // namespace cocaine::engine
+
+namespace cocaine { namespace io {
+
+    // NOTE: The ids are well above those of the rpc events.
+
+    template<>
+    struct event_traits<engine::shm::offer> {
+      enum constants { id = 100 };
+    };
+
+    template<>
+    struct event_traits<engine::shm::accept> {
+      enum constants { id = 101 };
+    };
+
+    template<>
+    struct event_traits<engine::shm::chunk> {
+      enum constants { id = 102 };
+    };
+
+  }} // namespace cocaine::io
+
+namespace cocaine { namespace engine {
+
+    // A ring of records in shared memory, written by one process and read by
+    // the other. Only the writer keeps the ring positions, the reader merely
+    // flags the records it's done with, in any order, and the writer reclaims
+    // them from the tail on the next write.
+    class shm_ring_t:
+      public boost::noncopyable
+    {
+    public:
+      // The size has to be a multiple of the record alignment.
+      shm_ring_t(char * base,
+                 size_t size);
+
+      // Writer
+
+      // Copies the data into a new record, returns false if there's no room.
+      bool
+      write(const char * data,
+            size_t size,
+            uint64_t& offset);
+
+      // Reader
+
+      // Returns the data of the record, or null if the descriptor is bogus.
+      char*
+      read(uint64_t offset,
+           uint64_t size) const;
+
+      // Flags the record holding the data as done.
+      static
+      void
+      release(char * data);
+
+      static const size_t alignment = 64;
+
+    private:
+      void
+      reclaim();
+
+    private:
+      char * const m_base;
+      const size_t m_size;
+
+      // Monotonic positions, the ring offset is the remainder.
+      uint64_t m_head,
+               m_tail;
+    };
+
+    // Shared memory side channel for large chunks. The worker creates the
+    // segment with a ring for either direction and offers it to the engine
+    // right after connecting. Once the engine has accepted it, the frames of
+    // the chunks above the threshold are written into the rings once, and
+    // only their descriptors go over the engine channel, see shm::chunk.
+    //
+    // NOTE: Incoming chunks point right into the segment, so it has to
+    // outlive every one of them.
+    //
+    // NOTE: The name is removed as soon as the engine accepts, or once the
+    // worker gives up waiting for it, so the memory goes away along with
+    // both processes. A worker killed before either of those leaves the
+    // segment behind in /dev/shm, named after the worker uuid.
+    class side_channel_t:
+      public boost::noncopyable
+    {
+    public:
+      // Creates a new segment, on the worker side.
+      side_channel_t(const std::string& name,
+                     size_t size);
+
+      ~side_channel_t();
+
+      // Maps the segment offered by the worker, on the engine side.
+      static
+      std::unique_ptr<side_channel_t>
+      open(const std::string& name);
+
+      const std::string&
+      name() const {
+        return m_name;
+      }
+
+      // Size of each ring.
+      size_t
+      size() const {
+        return m_size;
+      }
+
+      // Called once the peer has mapped the segment, which removes its name
+      // and starts using it.
+      void
+      accept();
+
+      // Removes the name of the segment, after which the peer can't map it
+      // anymore. Whatever is mapped already stays in place.
+      void
+      unlink();
+
+      bool
+      accepted() const {
+        return m_accepted.load(std::memory_order_acquire);
+      }
+
+      // Copies a chunk frame into the outgoing ring. Returns false if the
+      // peer hasn't accepted the segment yet or the ring is full, in which
+      // case the frame has to be sent over the channel. Thread-safe.
+      bool
+      write(const char * data,
+            size_t size,
+            uint64_t& offset);
+
+      // Wraps a chunk frame in the incoming ring into a message, which frees
+      // its record once destroyed. Returns false for a bogus descriptor.
+      bool
+      read(uint64_t offset,
+           uint64_t size,
+           zmq::message_t& frame);
+
+    private:
+      side_channel_t(const std::string& name,
+                     int fd);
+
+      // Maps the segment and closes the descriptor.
+      void
+      map(int fd);
+
+    private:
+      const std::string m_name;
+      const size_t m_size;
+
+      const bool m_owner;
+      bool m_linked;
+
+      std::atomic<bool> m_accepted;
+
+      void * m_base;
+
+      std::unique_ptr<shm_ring_t> m_incoming,
+                                  m_outgoing;
+
+      // Every sandbox thread writes its own replies.
+      std::mutex m_mutex;
+    };
+
+  }} // namespace cocaine::engine
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef COCAINE_GENERIC_WORKER_SPSC_HPP
+#define COCAINE_GENERIC_WORKER_SPSC_HPP
+
+#include <cocaine/common.hpp>
+
+#include <atomic>
+
+namespace cocaine { namespace engine {
+
+    // Bounded lock-free ring for exactly one producer and one consumer
+    // thread. The capacity is rounded up to a power of two.
+    template<class T>
+    class spsc_queue_t:
+    public boost::noncopyable
+    {
+    public:
+      explicit
+      spsc_queue_t(size_t capacity);
+
+      // Producer side, returns false if the ring is full.
+      bool
+      push(const T& value);
+
+      // Consumer side, returns false if the ring is empty.
+      bool
+      pop(T& value);
+
+      // Approximate, unless called from the consumer thread with the
+      // producer idle.
+      size_t
+      size() const {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+      }
+
+      size_t
+      capacity() const {
+        return m_mask + 1;
+      }
+
+    private:
+      static
+      size_t
+      round(size_t capacity);
+
+    private:
+      static const size_t line = 64;
+
+      const size_t m_mask;
+      std::unique_ptr<T[]> m_items;
+
+      // NOTE: Both indices grow without wrapping around the ring, and each
+      // is kept on a cache line of its own, so the threads don't contend.
+      char m_pad_0[line];
+      std::atomic<size_t> m_head;
+      char m_pad_1[line - sizeof(std::atomic<size_t>)];
+      std::atomic<size_t> m_tail;
+      char m_pad_2[line - sizeof(std::atomic<size_t>)];
+    };
+
+    template<class T>
+    spsc_queue_t<T>::spsc_queue_t(size_t capacity):
+      m_mask(round(capacity) - 1),
+      m_items(new T[m_mask + 1]),
+      m_head(0),
+      m_tail(0)
+    { }
+
+    template<class T>
+    bool
+    spsc_queue_t<T>::push(const T& value) {
+      const size_t tail = m_tail.load(std::memory_order_relaxed);
+
+      if(tail - m_head.load(std::memory_order_acquire) > m_mask) {
+        return false;
+      }
+
+      m_items[tail & m_mask] = value;
+      m_tail.store(tail + 1, std::memory_order_release);
+
+      return true;
+    }
+
+    template<class T>
+    bool
+    spsc_queue_t<T>::pop(T& value) {
+      const size_t head = m_head.load(std::memory_order_relaxed);
+
+      if(head == m_tail.load(std::memory_order_acquire)) {
+        return false;
+      }
+
+      value = m_items[head & m_mask];
+      m_head.store(head + 1, std::memory_order_release);
+
+      return true;
+    }
+
+    template<class T>
+    size_t
+    spsc_queue_t<T>::round(size_t capacity) {
+      size_t result = 1;
+
+      while(result < capacity) {
+        result <<= 1;
+      }
+
+      return result;
+    }
+
+  }} // namespace cocaine::engine
+
+#endif
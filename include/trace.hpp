@@ -0,0 +1,93 @@
+#ifndef COCAINE_GENERIC_WORKER_TRACE_HPP
+#define COCAINE_GENERIC_WORKER_TRACE_HPP
+
+#include <cocaine/common.hpp>
+#include <cocaine/logging.hpp>
+
+#include <chrono>
+
+// Tracepoints above this level are compiled out entirely.
+#ifndef COCAINE_WORKER_TRACE_LEVEL
+  #define COCAINE_WORKER_TRACE_LEVEL 4
+#endif
+
+// NOTE: Both the compile-time and the runtime checks come before anything
+// is evaluated for the tracepoint arguments.
+#define COCAINE_WORKER_TRACE(_tracer_, _level_, _event_, _argument_)          \
+  do {                                                                        \
+    if((_level_) <= COCAINE_WORKER_TRACE_LEVEL && (_tracer_).enabled(_level_)) { \
+      (_tracer_).record((_level_), (_event_), (_argument_));                  \
+    }                                                                         \
+  } while(0)
+
+namespace cocaine { namespace engine {
+
+    enum class trace_event_t: uint32_t {
+      // The argument is the message type.
+      received
+    };
+
+    // Hot-path tracing. In the log mode every tracepoint is formatted into
+    // the log right away, provided the log verbosity allows it. In the ring
+    // mode only a small binary record is stored in a fixed-size ring, and
+    // the ring is formatted into the log on demand, see dump().
+    class tracer_t:
+    public boost::noncopyable
+    {
+    public:
+      enum class mode_t: int {
+        off,
+          log,
+          ring
+          };
+
+      tracer_t(logging::log_t * log,
+               const std::string& source,
+               mode_t mode,
+               size_t ring_size);
+
+      bool
+      enabled(logging::priorities level) const {
+        switch(m_mode) {
+          case mode_t::log:
+            return m_log->verbosity() >= level;
+
+          case mode_t::ring:
+            return true;
+
+          default:
+            return false;
+        }
+      }
+
+      void
+      record(logging::priorities level,
+             trace_event_t event,
+             int64_t argument);
+
+      // Writes the ring contents into the log, oldest records first.
+      void
+      dump();
+
+    private:
+      typedef std::chrono::steady_clock clock_type;
+
+      struct record_t {
+        clock_type::rep timestamp;
+        trace_event_t event;
+        logging::priorities level;
+        int64_t argument;
+      };
+
+      logging::log_t * m_log;
+
+      const std::string m_source;
+      const mode_t m_mode;
+
+      std::vector<record_t> m_ring;
+      uint64_t m_position;
+    };
+
+  }} // namespace cocaine::engine
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef COCAINE_GENERIC_WORKER_TRANSPORT_HPP
+#define COCAINE_GENERIC_WORKER_TRANSPORT_HPP
+
+#include <cocaine/common.hpp>
+#include <cocaine/traits.hpp>
+#include <cocaine/unique_id.hpp>
+
+#include <cstring>
+
+#include <zmq.hpp>
+
+namespace cocaine { namespace engine {
+
+    // Where the sessions send their messages: either straight into the
+    // engine channel, or over to the thread which owns it.
+    class transport_t {
+    public:
+      virtual
+      ~transport_t() {
+        // Empty.
+      }
+
+      // Takes the contents of the frames, which make up a whole message.
+      virtual
+      void
+      send(zmq::message_t * frames,
+           size_t count) = 0;
+
+      // Whether the transport is below its high watermark, see the
+      // writable_stream_t interface.
+      virtual
+      bool
+      writable() const = 0;
+
+      // Called once a session has been dropped by the reaper, for whoever
+      // keeps track of the sessions besides the executor.
+      virtual
+      void
+      expired(const unique_id_t& session_id) {
+        // Empty.
+      }
+    };
+
+    // Packs the value into a frame of its own.
+    template<class T>
+    void
+    pack_frame(zmq::message_t& frame,
+               const T& value)
+    {
+      msgpack::sbuffer buffer;
+      msgpack::packer<msgpack::sbuffer> packer(buffer);
+
+      io::type_traits<T>::pack(packer, value);
+
+      frame.rebuild(buffer.size());
+
+      std::memcpy(frame.data(), buffer.data(), buffer.size());
+    }
+
+  }} // namespace cocaine::engine
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef COCAINE_GENERIC_WORKER_UPSTREAM_HPP
+#define COCAINE_GENERIC_WORKER_UPSTREAM_HPP
+
+#include <cocaine/common.hpp>
+#include <cocaine/unique_id.hpp>
+
+#include <cocaine/api/stream.hpp>
+
+#include <boost/enable_shared_from_this.hpp>
+
+#include "chunk.hpp"
+#include "metrics.hpp"
+#include "outbox.hpp"
+
+namespace cocaine { namespace engine {
+
+    class executor_t;
+
+    // The response stream of a single session, handed to the sandbox.
+    class upstream_t:
+      public api::stream_t,
+      public owning_stream_t,
+      public writable_stream_t,
+      public boost::enable_shared_from_this<upstream_t>
+    {
+    public:
+      // Chunks smaller than the coalescing threshold are merged until the
+      // threshold is reached, the stream is closed or the current loop
+      // iteration ends. A zero threshold sends every chunk on its own.
+      //
+      // The time from the construction till the stream is closed is
+      // recorded into the latency histogram.
+      upstream_t(const unique_id_t& id,
+                 executor_t * const executor,
+                 size_t coalesce,
+                 histogram_t& latency);
+
+      virtual
+      ~upstream_t();
+
+      virtual
+      void
+      push(const char * chunk,
+           size_t size);
+
+      virtual
+      void
+      push(char * chunk,
+           size_t size,
+           size_t headroom,
+           release_t release,
+           void * hint);
+
+      virtual
+      void
+      error(error_code code,
+            const std::string& message);
+
+      virtual
+      void
+      close();
+
+      virtual
+      bool
+      writable() const;
+
+      virtual
+      void
+      on_drain(callback_t callback);
+
+      // Called by the executor once the transport has drained.
+      void
+      drained();
+
+      bool
+      closed() const {
+        return m_state == state_t::closed;
+      }
+
+      // Reaper tick of the last chunk pushed, see executor_t.
+      uint64_t
+      activity() const {
+        return m_activity;
+      }
+
+      // Sends the coalesced chunks, if any.
+      void
+      flush();
+
+    private:
+      // Returns true if the chunk has been merged into the pending one.
+      bool
+      coalesce(const char * chunk,
+               size_t size);
+
+    private:
+      const unique_id_t m_id;
+      executor_t * const m_executor;
+
+      enum class state_t: int {
+        open,
+          closed
+          };
+
+      state_t m_state;
+
+      const size_t m_coalesce;
+      std::string m_pending;
+
+      callback_t m_drain;
+
+      histogram_t& m_latency;
+      const metrics_t::clock_type::time_point m_started;
+
+      uint64_t m_activity;
+    };
+
+  }} // namespace cocaine::engine
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef COCAINE_GENERIC_WORKER_WHEEL_HPP
+#define COCAINE_GENERIC_WORKER_WHEEL_HPP
+
+#include <cocaine/common.hpp>
+
+#include <vector>
+
+namespace cocaine { namespace engine {
+
+    // Hierarchical timer wheel with four levels of 64 slots. Scheduling is
+    // O(1), and so is advancing, amortized over the cascades of the upper
+    // levels into the lower ones. Entries can't be cancelled, the owner is
+    // expected to check whether a fired entry is still relevant.
+    template<class T>
+    class timer_wheel_t:
+    public boost::noncopyable
+    {
+    public:
+      timer_wheel_t();
+
+      // Fires the value once the wheel has advanced by the given number of
+      // ticks, at least by one.
+      void
+      schedule(uint64_t delay,
+               const T& value);
+
+      // Advances the wheel by a single tick, calling the callback for every
+      // value which has expired.
+      template<class Callback>
+      void
+      advance(Callback callback);
+
+      // Moves an empty wheel to the given tick at once.
+      void
+      skip(uint64_t now) {
+        BOOST_ASSERT(m_size == 0);
+        m_now = std::max(m_now, now);
+      }
+
+      uint64_t
+      now() const {
+        return m_now;
+      }
+
+      size_t
+      size() const {
+        return m_size;
+      }
+
+      bool
+      empty() const {
+        return m_size == 0;
+      }
+
+    private:
+      struct entry_t {
+        uint64_t deadline;
+        T value;
+      };
+
+      void
+      place(const entry_t& entry);
+
+    private:
+      static const unsigned bits = 6;
+      static const unsigned levels = 4;
+      static const size_t slots = 1 << bits;
+      static const uint64_t mask = slots - 1;
+
+      std::vector<entry_t> m_slots[levels][slots];
+
+      uint64_t m_now;
+      size_t m_size;
+    };
+
+    template<class T>
+    timer_wheel_t<T>::timer_wheel_t():
+      m_now(0),
+      m_size(0)
+    { }
+
+    template<class T>
+    void
+    timer_wheel_t<T>::schedule(uint64_t delay,
+                               const T& value)
+    {
+      const entry_t entry = { m_now + std::max<uint64_t>(delay, 1), value };
+
+      place(entry);
+      ++m_size;
+    }
+
+    template<class T>
+    template<class Callback>
+    void
+    timer_wheel_t<T>::advance(Callback callback) {
+      ++m_now;
+
+      // NOTE: Once a lower level wraps around, the next slot of the upper one
+      // is spread over the levels below it, down to the current slot.
+      for(unsigned level = 1; level < levels; ++level) {
+        if(m_now & ((1ULL << (bits * level)) - 1)) {
+          break;
+        }
+
+        std::vector<entry_t> cascaded;
+
+        cascaded.swap(m_slots[level][(m_now >> (bits * level)) & mask]);
+
+        for(auto it = cascaded.begin(); it != cascaded.end(); ++it) {
+          place(*it);
+        }
+      }
+
+      std::vector<entry_t> expired;
+
+      expired.swap(m_slots[0][m_now & mask]);
+
+      for(auto it = expired.begin(); it != expired.end(); ++it) {
+        // NOTE: Deadlines beyond the span of the wheel go around the upper
+        // level until they're due.
+        if(it->deadline > m_now) {
+          place(*it);
+          continue;
+        }
+
+        --m_size;
+        callback(it->value);
+      }
+    }
+
+    template<class T>
+    void
+    timer_wheel_t<T>::place(const entry_t& entry) {
+      const uint64_t delta = entry.deadline > m_now ? entry.deadline - m_now : 0;
+
+      unsigned level = 0;
+
+      while(level + 1 < levels && delta >> (bits * (level + 1))) {
+        ++level;
+      }
+
+      m_slots[level][(std::max(entry.deadline, m_now) >> (bits * level)) & mask].push_back(entry);
+    }
+
+  }} // namespace cocaine::engine
+
+#endif
@@ -9,18 +9,94 @@
 
 #include <cocaine/api/stream.hpp>
 
-#include <nodejs/uv.h>
+#include "budget.hpp"
+#include "dispatcher.hpp"
+#include "executor.hpp"
+#include "metrics.hpp"
+#include "monitor.hpp"
+#include "outbox.hpp"
+#include "protocol.hpp"
+#include "reactor.hpp"
+#include "session_map.hpp"
+#include "settings.hpp"
+#include "shard.hpp"
 
 namespace cocaine { namespace engine {
 
+    // The app loaded ahead of time by a zygote, see zygote_t, or just the
+    // profile, once main() has looked into it. Whatever is missing is loaded
+    // by the worker itself.
+    struct preload_t {
+      std::unique_ptr<const manifest_t> manifest;
+      std::unique_ptr<const profile_t> profile;
+      std::unique_ptr<const settings_t> settings;
+      std::unique_ptr<reactor_t> reactor;
+
+      // Only preloaded in the single-threaded mode, if enabled.
+      std::unique_ptr<api::sandbox_t> sandbox;
+    };
+
     struct worker_config_t {
       std::string app;
       std::string profile;
       std::string uuid;
+
+      // Overrides the sandbox specified in the manifest, mostly useful to
+      // run the worker against a stub sandbox in benchmarks.
+      std::function<std::unique_ptr<api::sandbox_t>()> sandbox;
+
+      // Whatever is set here is taken over instead of being loaded.
+      std::shared_ptr<preload_t> preload;
+
+      // The startup phases timed before the worker is constructed.
+      timeline_t startup;
     };
 
+    struct worker_stats_t {
+      // Loop wakeups which ran the channel handler, and those of them which
+      // found nothing queued in the channel.
+      uint64_t wakeups;
+      uint64_t wasted_wakeups;
+
+      // Current adaptive limit of messages handled per drain.
+      unsigned long io_bulk_size;
+
+      // Session state allocations served by the pool, and those which had
+      // to fall back to the heap.
+      uint64_t pool_hits;
+      uint64_t pool_misses;
+
+      // Inbound bytes held by the sandbox instances.
+      uint64_t inflight_bytes;
+
+      // Times the channel reading has been paused by the flow control.
+      uint64_t throttles;
+
+      // Messages which would have blocked and have been queued instead.
+      uint64_t send_stalls;
+
+      // Event loop lag and busy ratio as of the last heartbeat.
+      double loop_lag;
+      double loop_busy;
+
+      // Resident set size as of the last heartbeat.
+      uint64_t rss;
+    };
+
+    // The messages the worker takes from the engine.
+    typedef events_t<
+      io::rpc::heartbeat,
+      io::rpc::invoke,
+      io::rpc::chunk,
+      io::rpc::choke,
+      io::rpc::terminate,
+      shm::accept,
+      shm::chunk
+    > worker_events_t;
+
     class worker_t:
-    public boost::noncopyable
+      public transport_t,
+      public boost::noncopyable
     {
     public:
       worker_t(context_t& context,
@@ -35,21 +111,133 @@ namespace cocaine { namespace engine {
       void
       send(Args&&... args);
 
+      worker_stats_t
+      stats() const;
+
+      // Serialized JSON snapshot of the worker metrics.
+      std::string
+      snapshot() const;
+
+      // Transport for the executor running on the worker thread.
+
+      virtual
+      void
+      send(zmq::message_t * frames,
+           size_t count);
+
+      virtual
+      bool
+      writable() const;
+
     private:
+      // Offers the shared memory and logs the startup timeline, right before
+      // the loop starts.
       void
-      on_event(ev::io&, int);
+      ready();
+
+      void
+      on_event();
         
       void
-      on_check(ev::prepare&, int);
+      rearm();
+
+      void
+      on_resume();
+
+      void
+      on_notify();
+
+      void
+      on_drain();
         
       void
-      on_heartbeat(ev::timer&, int);
+      on_heartbeat();
+
+      void
+      on_tick();
+
+      void
+      on_dump();
 
       void
-      on_disown(ev::timer&, int);
+      on_disown();
+
+      // Polling the channel has failed, the worker can't hear the engine.
+      void
+      on_channel_error(const std::string& reason);
+
+      // The engine hasn't accepted the shared memory in time.
+      void
+      on_offer_timeout();
 
       void
       process();
+
+      // Engine messages, see protocol_t.
+
+      friend class protocol_t<worker_t, io::unique_channel_t, worker_events_t>;
+
+      void
+      handle(event_tag<io::rpc::heartbeat>);
+
+      void
+      handle(event_tag<io::rpc::invoke>,
+             const unique_id_t& session_id,
+             const std::string& event);
+
+      // Takes the contents of the frame.
+      void
+      handle(event_tag<io::rpc::chunk>,
+             const unique_id_t& session_id,
+             zmq::message_t& frame);
+
+      void
+      handle(event_tag<io::rpc::choke>,
+             const unique_id_t& session_id);
+
+      void
+      handle(event_tag<io::rpc::terminate>);
+
+      void
+      handle(event_tag<shm::accept>);
+
+      void
+      handle(event_tag<shm::chunk>,
+             const unique_id_t& session_id,
+             uint64_t offset,
+             uint64_t size);
+
+      // Stops taking new sessions and terminates once the open ones are
+      // closed, or once the drain timeout expires.
+      void
+      retire();
+
+      void
+      on_retire();
+
+      void
+      on_retire_timeout();
+
+      // Sessions which haven't sent their choke yet.
+      size_t
+      open() const;
+
+      // Hands over the commands queued for the shards and collects their
+      // outgoing messages, then pokes the idle shards if any other one is
+      // behind.
+      void
+      exchange();
+
+      // Whether the sandbox side is behind and the channel mustn't be read.
+      bool
+      congested() const;
+
+      size_t
+      sessions() const;
+
+      // The shard with the fewest sessions, started or queued.
+      size_t
+      least_loaded();
         
       void
       terminate(io::rpc::suicide::reasons reason,
@@ -66,47 +254,106 @@ namespace cocaine { namespace engine {
       // Engine I/O
 
       io::unique_channel_t m_channel;
-        
+
+      // Outgoing messages the channel couldn't take right away.
+      std::unique_ptr<outbox_t> m_outbox;
+
       // Event loop
 
-      ev::default_loop m_loop;
-        
-      ev::io m_watcher;
-      ev::prepare m_checker;
+      std::unique_ptr<reactor_t> m_reactor;
         
-      ev::timer m_heartbeat_timer,
-        m_disown_timer;
+      std::unique_ptr<io_watcher_t> m_watcher;
+      std::unique_ptr<idle_watcher_t> m_checker;
+
+      std::unique_ptr<loop_monitor_t> m_monitor;
+
+      // NOTE: The channel descriptor only signals edges, so whenever ZeroMQ
+      // might have consumed one, the actual state is read from ZMQ_EVENTS.
+      enum class readiness_t: int {
+        // Nothing is queued, sleeping until the descriptor fires.
+        waiting,
+          // Messages are queued either way, draining on every loop iteration.
+          draining,
+          // Inside process(), the state is re-evaluated once it's done.
+          processing,
+          // The sandbox is behind, not reading until it catches up.
+          throttled
+          };
+
+      readiness_t m_readiness;
+
+      std::unique_ptr<io_budget_t> m_budget;
+
+      std::unique_ptr<timer_watcher_t> m_heartbeat_timer,
+        m_disown_timer,
+        m_metrics_timer,
+        m_retire_timer,
+        m_offer_timer;
+
+      // Checks whether all the sessions are closed, while retiring. Once the
+      // drain timeout expires, the open sessions are failed, and the shards
+      // are given a grace period to do so.
+      std::unique_ptr<prepare_watcher_t> m_retirer;
+      bool m_retiring,
+           m_aborting;
+
+      // Decodes the engine messages right into the handlers above.
+      protocol_t<worker_t, io::unique_channel_t, worker_events_t> m_protocol;
+
+      // Metrics
+
+      metrics_t m_metrics;
+      std::unique_ptr<metrics_socket_t> m_metrics_socket;
+
+      // Tracing, the ring is dumped into the log on SIGUSR2.
+
+      std::unique_ptr<tracer_t> m_tracer;
+      std::unique_ptr<signal_watcher_t> m_dump_signal;
 
-      uv_poll_t* m_uv_poll_handle_;
-        
       // The app
 
       std::unique_ptr<const manifest_t> m_manifest;
       std::unique_ptr<const profile_t> m_profile;
-      std::unique_ptr<api::sandbox_t> m_sandbox;
+      std::unique_ptr<const settings_t> m_settings;
 
-      struct io_pair_t {
-        boost::shared_ptr<api::stream_t> upstream;
-        boost::shared_ptr<api::stream_t> downstream;
-      };
+      // Shared memory for the large chunks, if enabled. It has to outlive the
+      // sandboxes, which might hold on to the chunks in there.
+      std::unique_ptr<side_channel_t> m_side;
 
-#if BOOST_VERSION >= 103600
-      typedef boost::unordered_map<
-#else
-        typedef std::map<
-#endif
-          unique_id_t,
-          io_pair_t
-          > stream_map_t;
+      // Wakes the worker thread up on behalf of the shards.
+      std::unique_ptr<async_watcher_t> m_notifier;
+
+      // Either a single executor running on the worker thread, or a shard
+      // per sandbox thread.
+      std::unique_ptr<executor_t> m_executor;
+
+      // New sessions go to the least loaded shard, but might get stolen by
+      // another one until started. The rest of the session follows it.
+      std::unique_ptr<dispatcher_t> m_dispatcher;
+      typedef session_map_t<boost::shared_ptr<pending_t>> affinity_map_t;
 
-      // Session streams.
-      stream_map_t m_streams;
+      affinity_map_t m_affinity;
+
+      // Sessions dropped by the shards' reapers, see exchange().
+      std::vector<unique_id_t> m_expired;
+      size_t m_next;
+
+      std::vector<std::unique_ptr<shard_t>> m_shards;
+
+      worker_stats_t m_stats;
+
+      timeline_t m_startup;
     };
 
     template<class Event, typename... Args>
     void
     worker_t::send(Args&&... args) {
-      m_channel.send<Event>(std::forward<Args>(args)...);
+      m_outbox->send<Event>(std::forward<Args>(args)...);
+
+      // Sending might have swallowed the edge of an incoming message.
+      if(m_readiness == readiness_t::waiting || m_readiness == readiness_t::throttled) {
+        rearm();
+      }
     }
 
   }} // namespace cocaine::engine
@@ -0,0 +1,130 @@
+#ifndef COCAINE_GENERIC_WORKER_ZYGOTE_HPP
+#define COCAINE_GENERIC_WORKER_ZYGOTE_HPP
+
+#include <cocaine/common.hpp>
+
+#include <chrono>
+#include <map>
+
+#include <sys/types.h>
+
+#include "worker.hpp"
+
+namespace cocaine { namespace engine {
+
+    // Thrown by the zygote if the sandbox has started threads while being
+    // preloaded. Those wouldn't survive a fork, and the sandbox can't be
+    // unloaded for good either, so the zygote has to start over without
+    // preloading it.
+    struct preload_error_t:
+      public cocaine::error_t
+    {
+      preload_error_t(size_t threads):
+        cocaine::error_t("the sandbox has started %llu threads while being preloaded", threads)
+      { }
+    };
+
+    // A template process which loads the app once and then forks workers
+    // with the app already loaded, so that they start in milliseconds.
+    //
+    // It listens on a local UNIX socket, see endpoint(). A request is the
+    // worker uuid followed by a newline, and the zygote replies with the
+    // worker pid and, once the worker is gone, with its wait status, one
+    // line each. Hanging up on the zygote kills the worker. The socket is
+    // only accessible to, and only served for, the user the zygote runs as.
+    //
+    // NOTE: Only a single-threaded process can be forked safely, so the
+    // sandbox is preloaded only as long as it doesn't start any threads,
+    // see preload_error_t, and no worker is forked once it has.
+    class zygote_t:
+      public boost::noncopyable
+    {
+    public:
+      zygote_t(context_t& context,
+               const std::string& app,
+               const std::string& profile,
+               bool preload);
+
+      ~zygote_t();
+
+      // Serves the requests until a worker is forked, and returns in the
+      // worker process only, with the configuration it has to run with.
+      worker_config_t
+      run();
+
+      static
+      std::string
+      endpoint(const std::string& runtime,
+               const std::string& app,
+               const std::string& profile);
+
+    private:
+      // A client which hasn't sent its request in full yet.
+      struct request_t {
+        std::string line;
+        std::chrono::steady_clock::time_point deadline;
+      };
+
+      // Milliseconds till the earliest request deadline, for poll().
+      int
+      timeout() const;
+
+      void
+      on_accept();
+
+      // Drops the clients which haven't sent their requests in time.
+      void
+      on_expire();
+
+      // Both return true in the forked worker.
+
+      bool
+      on_read(int client,
+              worker_config_t& config);
+
+      bool
+      on_request(int client,
+                 const std::string& uuid,
+                 worker_config_t& config);
+
+      void
+      on_child();
+
+      void
+      on_hangup(pid_t pid);
+
+    private:
+      context_t& m_context;
+      std::unique_ptr<logging::log_t> m_log;
+
+      const std::string m_app,
+                        m_profile,
+                        m_path;
+
+      std::shared_ptr<preload_t> m_preload;
+
+      // Threads the process had before the sandbox was preloaded.
+      size_t m_threads;
+
+      int m_listener,
+          m_signals;
+
+      // Connections of the clients which are still sending their requests,
+      // and of those which have got their workers.
+      std::map<int, request_t> m_requests;
+      std::map<pid_t, int> m_children;
+
+      bool m_forked;
+    };
+
+    // Asks the zygote listening on the endpoint for a worker and waits for
+    // it to exit, relaying the termination signals. Returns false if there
+    // is no zygote, and the exit code of the worker otherwise.
+    bool
+    spawn(const std::string& endpoint,
+          const std::string& uuid,
+          int& code);
+
+  }} // namespace cocaine::engine
+
+#endif
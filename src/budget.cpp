@@ -0,0 +1,45 @@
+#include "budget.hpp"
+
+#include <algorithm>
+
+using namespace cocaine;
+using namespace cocaine::engine;
+
+io_budget_t::io_budget_t(unsigned long initial,
+                         unsigned long minimum,
+                         unsigned long maximum,
+                         double slice):
+  m_minimum(minimum),
+  m_maximum(maximum),
+  m_slice(std::chrono::duration_cast<clock_type::duration>(
+    std::chrono::duration<double>(slice)
+  )),
+  m_limit(initial),
+  m_processed(0),
+  m_overrun(false)
+{ }
+
+void
+io_budget_t::start() {
+  m_processed = 0;
+  m_started = clock_type::now();
+  m_overrun = false;
+}
+
+bool
+io_budget_t::consume() {
+  if(clock_type::now() - m_started >= m_slice) {
+    m_overrun = true;
+  }
+
+  return ++m_processed < m_limit && !m_overrun;
+}
+
+void
+io_budget_t::finish(bool drained) {
+  if(m_overrun) {
+    m_limit = std::max(m_minimum, m_processed / 2);
+  } else if(!drained && clock_type::now() - m_started < m_slice / 2) {
+    m_limit = std::min(m_maximum, m_limit * 2);
+  }
+}
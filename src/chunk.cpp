@@ -0,0 +1,239 @@
+#include "chunk.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <new>
+
+using namespace cocaine;
+using namespace cocaine::engine;
+
+namespace {
+  uint32_t
+  load_be(const unsigned char * data,
+          size_t length)
+  {
+    uint32_t result = 0;
+
+    for(size_t i = 0; i < length; ++i) {
+      result = (result << 8) | data[i];
+    }
+
+    return result;
+  }
+
+  // Writes a msgpack raw header, which is understood by every engine.
+  size_t
+  pack_header(unsigned char * target,
+              size_t size)
+  {
+    if(size < 32) {
+      target[0] = 0xA0 | size;
+      return 1;
+    }
+
+    size_t length = 2;
+
+    if(size < 65536) {
+      target[0] = 0xDA;
+    } else {
+      target[0] = 0xDB;
+      length = 4;
+    }
+
+    for(size_t i = length; i > 0; --i) {
+      target[i] = size & 0xFF;
+      size >>= 8;
+    }
+
+    return length + 1;
+  }
+
+  // NOTE: The widest raw header holds a 32-bit length.
+  void
+  check_size(size_t size) {
+    if(size > std::numeric_limits<uint32_t>::max()) {
+      throw cocaine::error_t("the chunk of %llu bytes is too large", static_cast<unsigned long long>(size));
+    }
+  }
+
+  size_t
+  header_size(size_t size) {
+    return size < 32 ? 1 : size < 65536 ? 3 : 5;
+  }
+
+  struct control_t {
+    char * data;
+    release_t release;
+    void * hint;
+  };
+
+  static_assert(
+    5 + sizeof(control_t) + alignof(control_t) - 1 <= owning_headroom,
+    "the owning headroom doesn't fit the control block"
+  );
+
+  void
+  on_release(void *, void * hint) {
+    control_t * control = static_cast<control_t*>(hint);
+
+    control->release(control->data, control->hint);
+
+    delete control;
+  }
+
+  // Same, for a control block placed in the headroom, which goes away along
+  // with the buffer.
+  void
+  on_release_embedded(void *, void * hint) {
+    const control_t control = *static_cast<control_t*>(hint);
+
+    control.release(control.data, control.hint);
+  }
+
+  // Finds an aligned spot for the control block in the headroom left below
+  // the frame header, if there's enough of it.
+  control_t*
+  embed_control(unsigned char * base,
+                size_t room)
+  {
+    if(room < sizeof(control_t)) {
+      return nullptr;
+    }
+
+    const uintptr_t at = (reinterpret_cast<uintptr_t>(base) - sizeof(control_t)) &
+      ~static_cast<uintptr_t>(alignof(control_t) - 1);
+
+    if(reinterpret_cast<uintptr_t>(base) - at > room) {
+      return nullptr;
+    }
+
+    return new(reinterpret_cast<void*>(at)) control_t();
+  }
+}
+
+chunk_t::chunk_t(const boost::shared_ptr<zmq::message_t>& frame,
+                 const char * data,
+                 size_t size):
+  m_frame(frame),
+  m_data(data),
+  m_size(size)
+{ }
+
+chunk_t
+chunk_t::decode(const boost::shared_ptr<zmq::message_t>& frame) {
+  const unsigned char * data = static_cast<const unsigned char*>(frame->data());
+  const size_t size = frame->size();
+
+  if(size == 0) {
+    throw cocaine::error_t("the chunk frame is empty");
+  }
+
+  size_t header = 0,
+         length = 0;
+
+  // NOTE: Both the legacy raw and the newer str/bin families are accepted,
+  // everything else is not a chunk payload.
+  if((data[0] & 0xE0) == 0xA0) {
+    header = 1;
+    length = data[0] & 0x1F;
+  } else {
+    switch(data[0]) {
+      case 0xC4: case 0xD9:
+        header = 2;
+        break;
+
+      case 0xC5: case 0xDA:
+        header = 3;
+        break;
+
+      case 0xC6: case 0xDB:
+        header = 5;
+        break;
+
+      default:
+        throw cocaine::error_t("the chunk frame is not a string");
+    }
+
+    if(size < header) {
+      throw cocaine::error_t("the chunk frame is truncated");
+    }
+
+    length = load_be(data + 1, header - 1);
+  }
+
+  if(size - header != length) {
+    throw cocaine::error_t("the chunk frame is truncated");
+  }
+
+  return chunk_t(frame, reinterpret_cast<const char*>(data) + header, length);
+}
+
+void
+cocaine::engine::pack_chunk(zmq::message_t& frame,
+                            const char * data,
+                            size_t size)
+{
+  check_size(size);
+
+  frame.rebuild(header_size(size) + size);
+
+  unsigned char * target = static_cast<unsigned char*>(frame.data());
+
+  std::memcpy(target + pack_header(target, size), data, size);
+}
+
+void
+cocaine::engine::pack_chunk(zmq::message_t& frame,
+                            char * data,
+                            size_t size,
+                            size_t headroom,
+                            release_t release,
+                            void * hint)
+{
+  const size_t header = header_size(size);
+
+  if(headroom < header || size > std::numeric_limits<uint32_t>::max()) {
+    try {
+      pack_chunk(frame, static_cast<const char*>(data), size);
+    } catch(...) {
+      release(data, hint);
+      throw;
+    }
+
+    release(data, hint);
+
+    return;
+  }
+
+  unsigned char * base = reinterpret_cast<unsigned char*>(data) - header;
+
+  pack_header(base, size);
+
+  // NOTE: The headroom is released along with the data, so the control block
+  // is copied out before the release is called.
+  control_t * control = embed_control(base, headroom - header);
+  zmq_free_fn * callback = &on_release_embedded;
+
+  if(!control) {
+    try {
+      control = new control_t();
+    } catch(...) {
+      release(data, hint);
+      throw;
+    }
+
+    callback = &on_release;
+  }
+
+  control->data = data;
+  control->release = release;
+  control->hint = hint;
+
+  try {
+    frame.rebuild(base, header + size, callback, control);
+  } catch(...) {
+    callback(base, control);
+    throw;
+  }
+}
@@ -0,0 +1,176 @@
+#include "dispatcher.hpp"
+
+using namespace cocaine;
+using namespace cocaine::engine;
+
+dispatcher_t::dispatcher_t(size_t shards,
+                           size_t high,
+                           size_t low):
+  m_queues(shards),
+  m_budget(high, low),
+  m_congested(false),
+  m_buffered(0)
+{ }
+
+void
+dispatcher_t::push(size_t shard,
+                   const boost::shared_ptr<pending_t>& session)
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  m_queues[shard].sessions.push_back(session);
+  m_queues[shard].depth.store(m_queues[shard].sessions.size(), std::memory_order_relaxed);
+}
+
+bool
+dispatcher_t::chunk(pending_t& session,
+                    zmq::message_t& frame)
+{
+  if(session.owner.load(std::memory_order_acquire) >= 0) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  // NOTE: The session might have been started in the meantime, and then
+  // the owner is going to replay the buffer before anything it's sent.
+  if(session.owner.load(std::memory_order_relaxed) >= 0) {
+    return false;
+  }
+
+  std::unique_ptr<zmq::message_t> buffered(new zmq::message_t());
+
+  buffered->move(&frame);
+
+  const size_t size = buffered->size();
+
+  session.bytes += size;
+  session.chunks.push_back(std::move(buffered));
+
+  if(m_budget.acquire(size)) {
+    m_congested.store(true, std::memory_order_release);
+  }
+
+  m_buffered.store(m_budget.inflight(), std::memory_order_relaxed);
+
+  return true;
+}
+
+bool
+dispatcher_t::choke(pending_t& session) {
+  if(session.owner.load(std::memory_order_acquire) >= 0) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  if(session.owner.load(std::memory_order_relaxed) >= 0) {
+    return false;
+  }
+
+  session.choked = true;
+
+  return true;
+}
+
+std::vector<boost::shared_ptr<pending_t>>
+dispatcher_t::cancel() {
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  std::vector<boost::shared_ptr<pending_t>> result;
+
+  for(auto queue = m_queues.begin(); queue != m_queues.end(); ++queue) {
+    for(auto it = queue->sessions.begin(); it != queue->sessions.end(); ++it) {
+      if(m_budget.release((*it)->bytes)) {
+        m_congested.store(false, std::memory_order_release);
+      }
+
+      (*it)->bytes = 0;
+      (*it)->chunks.clear();
+
+      result.push_back(*it);
+    }
+
+    queue->sessions.clear();
+    queue->depth.store(0, std::memory_order_relaxed);
+  }
+
+  m_buffered.store(m_budget.inflight(), std::memory_order_relaxed);
+
+  return result;
+}
+
+boost::shared_ptr<pending_t>
+dispatcher_t::take(size_t shard) {
+  queue_t& queue = m_queues[shard];
+
+  if(queue.depth.load(std::memory_order_relaxed) == 0) {
+    return boost::shared_ptr<pending_t>();
+  }
+
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  if(queue.sessions.empty()) {
+    return boost::shared_ptr<pending_t>();
+  }
+
+  boost::shared_ptr<pending_t> session(queue.sessions.front());
+
+  queue.sessions.pop_front();
+  queue.depth.store(queue.sessions.size(), std::memory_order_relaxed);
+
+  session->owner.store(shard, std::memory_order_release);
+
+  return session;
+}
+
+boost::shared_ptr<pending_t>
+dispatcher_t::steal(size_t shard) {
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  queue_t * victim = nullptr;
+
+  for(size_t i = 0; i < m_queues.size(); ++i) {
+    if(i != shard && (!victim || m_queues[i].sessions.size() > victim->sessions.size())) {
+      victim = &m_queues[i];
+    }
+  }
+
+  // NOTE: A single queued session is most likely about to be taken by its
+  // own shard, it's a longer queue which tells that the shard is behind.
+  if(!victim || victim->sessions.size() < 2) {
+    return boost::shared_ptr<pending_t>();
+  }
+
+  // NOTE: The most recent session is the one its own shard would have got
+  // to last.
+  boost::shared_ptr<pending_t> session(victim->sessions.back());
+
+  victim->sessions.pop_back();
+  victim->depth.store(victim->sessions.size(), std::memory_order_relaxed);
+
+  session->owner.store(shard, std::memory_order_release);
+
+  return session;
+}
+
+bool
+dispatcher_t::release(pending_t& session) {
+  if(session.bytes == 0) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  const bool resumed = m_budget.release(session.bytes);
+
+  session.bytes = 0;
+
+  if(resumed) {
+    m_congested.store(false, std::memory_order_release);
+  }
+
+  m_buffered.store(m_budget.inflight(), std::memory_order_relaxed);
+
+  return resumed;
+}
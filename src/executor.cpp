@@ -0,0 +1,605 @@
+#include "executor.hpp"
+#include "upstream.hpp"
+
+#include <cocaine/rpc.hpp>
+
+#include <cocaine/api/sandbox.hpp>
+
+#include <cocaine/traits/unique_id.hpp>
+
+#include <cmath>
+#include <limits>
+
+using namespace cocaine;
+using namespace cocaine::engine;
+using namespace cocaine::io;
+
+namespace {
+  size_t
+  share(size_t limit,
+        size_t shares)
+  {
+    return limit ? std::max<size_t>(1, limit / shares) : 0;
+  }
+
+  // Reaper tick length in seconds.
+  const double resolution = 0.1;
+
+  uint64_t
+  ticks(double seconds) {
+    return static_cast<uint64_t>(std::ceil(seconds / resolution));
+  }
+}
+
+executor_t::executor_t(reactor_t& reactor,
+                       transport_t& transport,
+                       std::unique_ptr<api::sandbox_t> sandbox,
+                       const settings_t& settings,
+                       metrics_t& metrics,
+                       size_t shares,
+                       flow_control_t::callback_t resume,
+                       side_channel_t * side):
+  m_reactor(reactor),
+  m_transport(transport),
+  m_metrics(metrics),
+  m_coalesce(settings.chunk_coalesce_size),
+  m_side(side),
+  m_side_threshold(settings.shm_threshold),
+  m_flow(
+    m_pool,
+    settings.session_inflight_high,
+    settings.session_inflight_low,
+    share(settings.worker_inflight_high, shares),
+    settings.worker_inflight_low / shares,
+    resume
+  ),
+  m_idle_timeout(ticks(settings.session_idle_timeout)),
+  m_timeout(ticks(settings.session_timeout)),
+  m_epoch(reactor.now()),
+  m_reaping(false),
+  m_open(0),
+  m_sandbox(std::move(sandbox)),
+  m_batched(settings.sandbox_batching ? dynamic_cast<batch_sandbox_t*>(m_sandbox.get()) : nullptr),
+  m_streams(settings.session_capacity)
+{
+  m_flusher.reset(new prepare_watcher_t(reactor, std::bind(&executor_t::on_flush, this)));
+  m_reaper.reset(new timer_watcher_t(reactor, std::bind(&executor_t::on_reap, this)));
+}
+
+void
+executor_t::invoke(const unique_id_t& session_id,
+                   const std::string& event)
+{
+  boost::shared_ptr<upstream_t> upstream(
+    boost::allocate_shared<upstream_t>(
+      pool_allocator_t<upstream_t>(m_pool),
+      session_id,
+      this,
+      m_coalesce,
+      latency(event)
+    )
+  );
+
+  // NOTE: Every upstream sends its choke exactly once, see send_choke().
+  ++m_open;
+
+  if(m_batched) {
+    const uint64_t now = tick();
+
+    io_pair_t io = {
+      upstream,
+      boost::shared_ptr<api::stream_t>(),
+      nullptr,
+      nullptr,
+      m_flow.session(),
+      now,
+      m_timeout ? now + m_timeout : 0
+    };
+
+    io_pair_t& entry = m_streams.emplace(session_id, io).first->second;
+    batch_sandbox_t::session_t& session = slot(entry, session_id);
+
+    session.event = event;
+
+    const batch_sandbox_t::message_t message = {
+      batch_sandbox_t::message_t::type_t::invoke,
+      &session,
+      chunk_t()
+    };
+
+    m_batch.messages.push_back(message);
+
+    if(m_idle_timeout || m_timeout) {
+      schedule(session_id, io);
+    }
+
+    return;
+  }
+
+  try {
+    boost::shared_ptr<api::stream_t> downstream(
+      m_sandbox->invoke(event, upstream)
+    );
+
+    const uint64_t now = tick();
+
+    io_pair_t io = {
+      upstream,
+      downstream,
+      dynamic_cast<chunk_sink_t*>(downstream.get()),
+      nullptr,
+      m_flow.session(),
+      now,
+      m_timeout ? now + m_timeout : 0
+    };
+
+    m_streams.emplace(session_id, io);
+
+    if(m_idle_timeout || m_timeout) {
+      schedule(session_id, io);
+    }
+  } catch(const std::exception& e) {
+    upstream->error(invocation_error, e.what());
+  } catch(...) {
+    upstream->error(invocation_error, "unexpected exception");
+  }
+}
+
+void
+executor_t::chunk(const unique_id_t& session_id,
+                  zmq::message_t& message)
+{
+  stream_map_t::iterator it(m_streams.find(session_id));
+
+  // NOTE: This may be a chunk for a failed invocation, in which case there
+  // will be no active stream, so drop the message.
+  if(it == m_streams.end()) {
+    return;
+  }
+
+  // NOTE: The payload frame is taken as is and the chunk points right into
+  // it, so the bytes are never copied on the way in.
+  boost::shared_ptr<zmq::message_t> frame(
+    boost::allocate_shared<zmq::message_t>(
+      pool_allocator_t<zmq::message_t>(m_pool)
+    )
+  );
+
+  frame->move(&message);
+
+  it->second.activity = tick();
+
+  try {
+    if(m_flow.enabled()) {
+      frame = m_flow.charge(frame, it->second.budget);
+    }
+
+    const chunk_t chunk(chunk_t::decode(frame));
+
+    m_metrics.chunks_in.fetch_add(1, std::memory_order_relaxed);
+    m_metrics.bytes_in.fetch_add(chunk.size(), std::memory_order_relaxed);
+
+    if(m_batched) {
+      const batch_sandbox_t::message_t message = {
+        batch_sandbox_t::message_t::type_t::chunk,
+        &slot(it->second, session_id),
+        chunk
+      };
+
+      m_batch.messages.push_back(message);
+    } else if(it->second.sink) {
+      it->second.sink->push(chunk);
+    } else {
+      it->second.downstream->push(chunk.data(), chunk.size());
+    }
+  } catch(const std::exception& e) {
+    fail(it, e.what());
+  } catch(...) {
+    fail(it, "unexpected exception");
+  }
+}
+
+void
+executor_t::choke(const unique_id_t& session_id) {
+  stream_map_t::iterator it(m_streams.find(session_id));
+
+  // NOTE: This may be a choke for a failed invocation, in which case there
+  // will be no active stream, so drop the message.
+  if(it == m_streams.end()) {
+    return;
+  }
+
+  if(m_batched) {
+    batch_sandbox_t::session_t& session = slot(it->second, session_id);
+
+    const batch_sandbox_t::message_t message = {
+      batch_sandbox_t::message_t::type_t::choke,
+      &session,
+      chunk_t()
+    };
+
+    // NOTE: The session is dropped once the batch has been handed over.
+    session.choked = true;
+    m_batch.messages.push_back(message);
+
+    return;
+  }
+
+  try {
+    it->second.downstream->close();
+  } catch(const std::exception& e) {
+    it->second.upstream->error(invocation_error, e.what());
+  } catch(...) {
+    it->second.upstream->error(invocation_error, "unexpected exception");
+  }
+
+  m_streams.erase(it);
+}
+
+void
+executor_t::send_chunk(const unique_id_t& session_id,
+                       zmq::message_t& frame)
+{
+  m_metrics.chunks_out.fetch_add(1, std::memory_order_relaxed);
+  m_metrics.bytes_out.fetch_add(frame.size(), std::memory_order_relaxed);
+
+  uint64_t offset = 0;
+
+  // NOTE: Only the descriptor goes over the channel, the frame itself has
+  // been copied into the shared memory once and can go away.
+  if(m_side && frame.size() >= m_side_threshold &&
+     m_side->write(static_cast<const char*>(frame.data()), frame.size(), offset))
+  {
+    zmq::message_t frames[4];
+
+    pack_frame(frames[0], static_cast<int>(event_traits<shm::chunk>::id));
+    pack_frame(frames[1], session_id);
+    pack_frame(frames[2], offset);
+    pack_frame(frames[3], static_cast<uint64_t>(frame.size()));
+
+    m_transport.send(frames, 4);
+
+    return;
+  }
+
+  zmq::message_t frames[3];
+
+  pack_frame(frames[0], static_cast<int>(event_traits<rpc::chunk>::id));
+  pack_frame(frames[1], session_id);
+  frames[2].move(&frame);
+
+  m_transport.send(frames, 3);
+}
+
+void
+executor_t::send_error(const unique_id_t& session_id,
+                       int code,
+                       const std::string& message)
+{
+  zmq::message_t frames[4];
+
+  pack_frame(frames[0], static_cast<int>(event_traits<rpc::error>::id));
+  pack_frame(frames[1], session_id);
+  pack_frame(frames[2], code);
+  pack_frame(frames[3], message);
+
+  m_transport.send(frames, 4);
+}
+
+void
+executor_t::send_choke(const unique_id_t& session_id) {
+  zmq::message_t frames[2];
+
+  --m_open;
+
+  pack_frame(frames[0], static_cast<int>(event_traits<rpc::choke>::id));
+  pack_frame(frames[1], session_id);
+
+  m_transport.send(frames, 2);
+}
+
+void
+executor_t::defer(const boost::shared_ptr<upstream_t>& upstream) {
+  m_deferred.push_back(upstream);
+  m_flusher->start();
+}
+
+void
+executor_t::take_buffer(std::string& buffer) {
+  if(m_buffers.empty()) {
+    buffer.reserve(m_coalesce);
+    return;
+  }
+
+  buffer.swap(m_buffers.back());
+  m_buffers.pop_back();
+}
+
+void
+executor_t::recycle_buffer(std::string& buffer) {
+  buffer.clear();
+
+  m_buffers.emplace_back();
+  m_buffers.back().swap(buffer);
+}
+
+void
+executor_t::wait_drain(const boost::shared_ptr<upstream_t>& upstream) {
+  m_blocked.push_back(upstream);
+}
+
+void
+executor_t::drained() {
+  std::vector<boost::weak_ptr<upstream_t>> blocked;
+
+  blocked.swap(m_blocked);
+
+  for(auto it = blocked.begin(); it != blocked.end(); ++it) {
+    boost::shared_ptr<upstream_t> upstream(it->lock());
+
+    if(upstream) {
+      upstream->drained();
+    }
+  }
+}
+
+uint64_t
+executor_t::tick() const {
+  return static_cast<uint64_t>((m_reactor.now() - m_epoch) / resolution);
+}
+
+size_t
+executor_t::abort(error_code code,
+                  const std::string& message)
+{
+  std::vector<unique_id_t> sessions;
+
+  sessions.reserve(m_streams.size());
+
+  for(auto it = m_streams.begin(); it != m_streams.end(); ++it) {
+    sessions.push_back(it->first);
+  }
+
+  size_t failed = 0;
+
+  for(auto it = sessions.begin(); it != sessions.end(); ++it) {
+    stream_map_t::iterator stream(m_streams.find(*it));
+
+    // NOTE: Failing a session might have made the sandbox close another.
+    if(stream == m_streams.end()) {
+      continue;
+    }
+
+    const io_pair_t& io = stream->second;
+
+    if(!io.upstream->closed()) {
+      io.upstream->error(code, message);
+      ++failed;
+    }
+
+    if(io.slot) {
+      io.slot->error = message;
+    }
+
+    m_transport.expired(*it);
+    m_streams.erase(stream);
+  }
+
+  return failed;
+}
+
+void
+executor_t::on_reap() {
+  const uint64_t target = tick();
+
+  while(m_wheel.now() < target) {
+    m_wheel.advance([this](const unique_id_t& session_id) {
+      reap(session_id);
+    });
+  }
+
+  if(m_wheel.empty()) {
+    m_reaper->stop();
+    m_reaping = false;
+  }
+}
+
+void
+executor_t::reap(const unique_id_t& session_id) {
+  stream_map_t::iterator it(m_streams.find(session_id));
+
+  // NOTE: The session is gone already, the wheel entries are never removed.
+  if(it == m_streams.end()) {
+    return;
+  }
+
+  const io_pair_t& io = it->second;
+  const uint64_t now = m_wheel.now(),
+                 activity = std::max(io.activity, io.upstream->activity());
+
+  error_code code = timeout_error;
+  std::string message;
+
+  if(m_timeout && now >= io.deadline) {
+    code = deadline_error;
+    message = "the session has exceeded its deadline";
+  } else if(m_idle_timeout && now >= activity + m_idle_timeout) {
+    message = "the session has been idle for too long";
+  } else {
+    schedule(session_id, io);
+    return;
+  }
+
+  m_metrics.reaped.fetch_add(1, std::memory_order_relaxed);
+
+  // NOTE: The sandbox might have closed the upstream already, and then it's
+  // only the engine who has forgotten about the session.
+  if(!io.upstream->closed()) {
+    io.upstream->error(code, message);
+  }
+
+  // NOTE: The sandbox skips the failed sessions of the pending batch.
+  if(io.slot) {
+    io.slot->error = message;
+  }
+
+  m_transport.expired(session_id);
+  m_streams.erase(it);
+}
+
+void
+executor_t::schedule(const unique_id_t& session_id,
+                     const io_pair_t& io)
+{
+  uint64_t deadline = std::numeric_limits<uint64_t>::max();
+
+  if(m_timeout) {
+    deadline = io.deadline;
+  }
+
+  if(m_idle_timeout) {
+    deadline = std::min(deadline, std::max(io.activity, io.upstream->activity()) + m_idle_timeout);
+  }
+
+  if(m_wheel.empty()) {
+    m_wheel.skip(tick());
+  }
+
+  m_wheel.schedule(deadline > m_wheel.now() ? deadline - m_wheel.now() : 1, session_id);
+
+  if(!m_reaping) {
+    m_reaper->start(resolution, resolution);
+    m_reaping = true;
+  }
+}
+
+void
+executor_t::on_flush() {
+  std::vector<boost::weak_ptr<upstream_t>> deferred;
+
+  // NOTE: The sandbox might reply right away, so the batch goes first and
+  // the replies are flushed within the same iteration.
+  commit();
+
+  deferred.swap(m_deferred);
+  m_flusher->stop();
+
+  for(auto it = deferred.begin(); it != deferred.end(); ++it) {
+    boost::shared_ptr<upstream_t> upstream(it->lock());
+
+    // NOTE: Upstreams flush themselves when destroyed.
+    if(upstream) {
+      upstream->flush();
+    }
+  }
+}
+
+void
+executor_t::commit() {
+  if(m_batch.messages.empty()) {
+    return;
+  }
+
+  batch_sandbox_t::batch_t batch;
+
+  std::swap(batch, m_batch);
+
+  std::string failure;
+
+  try {
+    m_batched->push(batch);
+  } catch(const std::exception& e) {
+    failure = e.what();
+  } catch(...) {
+    failure = "unexpected exception";
+  }
+
+  for(auto session = batch.sessions.begin(); session != batch.sessions.end(); ++session) {
+    stream_map_t::iterator it(m_streams.find(session->id));
+
+    // NOTE: The session might have failed on a malformed chunk meanwhile.
+    if(it == m_streams.end()) {
+      continue;
+    }
+
+    io_pair_t& io = it->second;
+
+    io.slot = nullptr;
+
+    if(!failure.empty()) {
+      session->error = failure;
+    } else if(!io.downstream && !session->downstream && session->error.empty()) {
+      session->error = "the sandbox has not handled the invocation";
+    }
+
+    if(!session->error.empty()) {
+      if(!io.upstream->closed()) {
+        io.upstream->error(invocation_error, session->error);
+      }
+
+      m_streams.erase(it);
+      continue;
+    }
+
+    if(!io.downstream) {
+      io.downstream = session->downstream;
+      io.sink = dynamic_cast<chunk_sink_t*>(io.downstream.get());
+    }
+
+    if(session->choked) {
+      m_streams.erase(it);
+    }
+  }
+}
+
+void
+executor_t::fail(stream_map_t::iterator it,
+                 const std::string& message)
+{
+  it->second.upstream->error(invocation_error, message);
+
+  // NOTE: The sandbox skips the failed sessions of the pending batch.
+  if(it->second.slot) {
+    it->second.slot->error = message;
+  }
+
+  m_streams.erase(it);
+}
+
+batch_sandbox_t::session_t&
+executor_t::slot(io_pair_t& io,
+                 const unique_id_t& session_id)
+{
+  if(io.slot) {
+    return *io.slot;
+  }
+
+  const batch_sandbox_t::session_t session = {
+    session_id,
+    std::string(),
+    io.upstream,
+    io.downstream,
+    std::string(),
+    false
+  };
+
+  m_batch.sessions.push_back(session);
+  io.slot = &m_batch.sessions.back();
+
+  // NOTE: The batch is handed over at the end of the loop iteration, along
+  // with the coalesced chunks.
+  m_flusher->start();
+
+  return *io.slot;
+}
+
+histogram_t&
+executor_t::latency(const std::string& event) {
+  std::map<std::string, histogram_t*>::iterator it(m_latencies.find(event));
+
+  if(it == m_latencies.end()) {
+    it = m_latencies.insert(std::make_pair(event, &m_metrics.latency(event))).first;
+  }
+
+  return *it->second;
+}
@@ -0,0 +1,126 @@
+#include "flow.hpp"
+
+using namespace cocaine;
+using namespace cocaine::engine;
+
+watermark_t::watermark_t(size_t high,
+                         size_t low):
+  m_high(high),
+  m_low(low),
+  m_inflight(0),
+  m_congested(false)
+{ }
+
+bool
+watermark_t::acquire(size_t size) {
+  m_inflight += size;
+
+  if(m_high && !m_congested && m_inflight >= m_high) {
+    m_congested = true;
+    return true;
+  }
+
+  return false;
+}
+
+bool
+watermark_t::release(size_t size) {
+  m_inflight -= size;
+
+  if(m_congested && m_inflight <= m_low) {
+    m_congested = false;
+    return true;
+  }
+
+  return false;
+}
+
+struct flow_control_t::refund_t {
+  void
+  operator()(zmq::message_t *) {
+    flow->refund(frame->size(), session.get());
+
+    // NOTE: The deleter itself might live on while weak references to the
+    // handle exist, so the frame is let go right away.
+    frame.reset();
+    session.reset();
+  }
+
+  flow_control_t * flow;
+
+  boost::shared_ptr<zmq::message_t> frame;
+  boost::shared_ptr<watermark_t> session;
+};
+
+flow_control_t::flow_control_t(pool_t& pool,
+                               size_t session_high,
+                               size_t session_low,
+                               size_t worker_high,
+                               size_t worker_low,
+                               callback_t resume):
+  m_pool(pool),
+  m_session_high(session_high),
+  m_session_low(session_low),
+  m_worker_high(worker_high),
+  m_worker(worker_high, worker_low),
+  m_congested_sessions(0),
+  m_resume(resume)
+{ }
+
+bool
+flow_control_t::enabled() const {
+  return m_session_high != 0 || m_worker_high != 0;
+}
+
+boost::shared_ptr<watermark_t>
+flow_control_t::session() {
+  if(!m_session_high) {
+    return boost::shared_ptr<watermark_t>();
+  }
+
+  return boost::allocate_shared<watermark_t>(
+    pool_allocator_t<watermark_t>(m_pool),
+    m_session_high,
+    m_session_low
+  );
+}
+
+boost::shared_ptr<zmq::message_t>
+flow_control_t::charge(const boost::shared_ptr<zmq::message_t>& frame,
+                       const boost::shared_ptr<watermark_t>& session)
+{
+  const size_t size = frame->size();
+
+  m_worker.acquire(size);
+
+  if(session && session->acquire(size)) {
+    ++m_congested_sessions;
+  }
+
+  refund_t refund = { this, frame, session };
+
+  // NOTE: Should the allocation fail, the deleter is called right away, so
+  // the charge is refunded either way.
+  return boost::shared_ptr<zmq::message_t>(
+    frame.get(),
+    refund,
+    pool_allocator_t<zmq::message_t>(m_pool)
+  );
+}
+
+void
+flow_control_t::refund(size_t size,
+                       watermark_t * session)
+{
+  const bool congested = this->congested();
+
+  m_worker.release(size);
+
+  if(session && session->release(size)) {
+    --m_congested_sessions;
+  }
+
+  if(congested && !this->congested()) {
+    m_resume();
+  }
+}
@@ -1,11 +1,20 @@
 
 #include "worker.hpp"
+#include "zygote.hpp"
 
 #include <cocaine/config.hpp>
 #include <cocaine/context.hpp>
 #include <cocaine/logging.hpp>
+#include <cocaine/manifest.hpp>
+#include <cocaine/profile.hpp>
 
+#include <cocaine/api/sandbox.hpp>
+
+#include <cstring>
 #include <iostream>
+#include <vector>
+
+#include <unistd.h>
 
 #include <boost/program_options.hpp>
 
@@ -37,7 +46,9 @@ int main(int argc, char * argv[]) {
     ("profile", po::value<std::string>
      (&worker_config.profile))
     ("uuid", po::value<std::string>
-     (&worker_config.uuid));
+     (&worker_config.uuid))
+    ("zygote", "load the app and fork ready workers on request")
+    ("no-preload", "with --zygote, leave loading the sandbox to the workers");
 
   combined_options.add(general_options)
     .add(slave_options);
@@ -77,15 +88,120 @@ int main(int argc, char * argv[]) {
 
   // Startup
 
+  std::unique_ptr<config_t> config;
   std::unique_ptr<context_t> context;
 
+  worker_config.startup = timeline_t();
+
   try {
-    context.reset(new context_t(vm["configuration"].as<std::string>(), "slave"));
+    config.reset(new config_t(vm["configuration"].as<std::string>()));
   } catch(const std::exception& e) {
     std::cerr << "Error: unable to initialize the context - " << e.what() << std::endl;
     return EXIT_FAILURE;
   }
 
+  worker_config.startup.mark("config");
+
+  try {
+    context.reset(new context_t(*config, "slave"));
+  } catch(const std::exception& e) {
+    std::cerr << "Error: unable to initialize the context - " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  worker_config.startup.mark("context");
+
+  // NOTE: If the profile enables the zygote and there's one running for the
+  // app, the worker is forked by it and this process only stands in for the
+  // worker until it exits. Otherwise the worker takes the profile over.
+  if(!vm.count("zygote")) {
+    std::shared_ptr<preload_t> preload(std::make_shared<preload_t>());
+
+    try {
+      preload->profile.reset(new profile_t(*context, worker_config.profile));
+      preload->settings.reset(new settings_t(*preload->profile));
+    } catch(const std::exception& e) {
+      std::unique_ptr<log_t> log(
+        new log_t(*context, "main")
+        );
+
+      COCAINE_LOG_ERROR(
+        log,
+        "unable to start the worker - %s",
+        e.what());
+
+      return EXIT_FAILURE;
+    }
+
+    worker_config.startup.mark("profile");
+
+    int code = EXIT_SUCCESS;
+
+    const std::string endpoint(zygote_t::endpoint(
+      config->path.runtime,
+      worker_config.app,
+      worker_config.profile
+      ));
+
+    if(preload->settings->zygote && spawn(endpoint, worker_config.uuid, code)) {
+      return code;
+    }
+
+    worker_config.preload = preload;
+  }
+
+  std::unique_ptr<zygote_t> zygote;
+
+  if(vm.count("zygote")) {
+    try {
+      zygote.reset(new zygote_t(
+        *context,
+        worker_config.app,
+        worker_config.profile,
+        !vm.count("no-preload")
+        ));
+
+      // NOTE: Returns in the forked workers only.
+      worker_config = zygote->run();
+    } catch(const preload_error_t& e) {
+      std::unique_ptr<log_t> log(
+        new log_t(*context, "main")
+        );
+
+      COCAINE_LOG_WARNING(
+        log,
+        "restarting the zygote without preloading the sandbox - %s",
+        e.what());
+
+      // NOTE: The sandbox can't be unloaded for good, so the zygote starts
+      // over in a fresh process image instead.
+      std::vector<char*> args(argv, argv + argc);
+
+      args.push_back(const_cast<char*>("--no-preload"));
+      args.push_back(nullptr);
+
+      ::execv("/proc/self/exe", args.data());
+
+      COCAINE_LOG_ERROR(
+        log,
+        "unable to restart the zygote - %s",
+        std::strerror(errno));
+
+      return EXIT_FAILURE;
+    } catch(const std::exception& e) {
+      std::unique_ptr<log_t> log(
+        new log_t(*context, "main")
+        );
+
+      COCAINE_LOG_ERROR(
+        log,
+        "unable to run the zygote - %s",
+        e.what());
+
+      return EXIT_FAILURE;
+    }
+  }
+
   std::unique_ptr<worker_t> worker;
 
   try {
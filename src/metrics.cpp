@@ -0,0 +1,322 @@
+#include "metrics.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace cocaine;
+using namespace cocaine::engine;
+
+histogram_t::histogram_t():
+  m_count(0),
+  m_sum(0),
+  m_max(0)
+{
+  for(size_t i = 0; i < buckets; ++i) {
+    m_buckets[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void
+histogram_t::record(uint64_t value) {
+  m_buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+
+  m_count.fetch_add(1, std::memory_order_relaxed);
+  m_sum.fetch_add(value, std::memory_order_relaxed);
+
+  uint64_t max = m_max.load(std::memory_order_relaxed);
+
+  while(value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    // Empty.
+  }
+}
+
+uint64_t
+histogram_t::quantile(double q) const {
+  const uint64_t total = count();
+
+  if(total == 0) {
+    return 0;
+  }
+
+  const uint64_t target = std::max<uint64_t>(1, std::ceil(q * total));
+
+  uint64_t seen = 0;
+
+  for(size_t i = 0; i < buckets; ++i) {
+    seen += m_buckets[i].load(std::memory_order_relaxed);
+
+    // NOTE: The last bucket also takes every value beyond the range, so
+    // it's only bounded by the largest one.
+    if(seen >= target) {
+      return i + 1 < buckets ?
+        std::min(value_of(i), m_max.load(std::memory_order_relaxed)) :
+        m_max.load(std::memory_order_relaxed);
+    }
+  }
+
+  return m_max.load(std::memory_order_relaxed);
+}
+
+Json::Value
+histogram_t::snapshot() const {
+  Json::Value result(Json::objectValue);
+
+  const uint64_t total = count();
+
+  result["count"] = static_cast<Json::UInt64>(total);
+  result["mean"] = total ? static_cast<double>(m_sum.load(std::memory_order_relaxed)) / total : 0.0;
+  result["p50"] = static_cast<Json::UInt64>(quantile(0.5));
+  result["p90"] = static_cast<Json::UInt64>(quantile(0.9));
+  result["p99"] = static_cast<Json::UInt64>(quantile(0.99));
+  result["p999"] = static_cast<Json::UInt64>(quantile(0.999));
+  result["max"] = static_cast<Json::UInt64>(m_max.load(std::memory_order_relaxed));
+
+  return result;
+}
+
+size_t
+histogram_t::bucket_of(uint64_t value) {
+  if(value < (1ULL << precision)) {
+    return value;
+  }
+
+  const unsigned magnitude = 63 - __builtin_clzll(value);
+
+  if(magnitude >= magnitudes) {
+    return buckets - 1;
+  }
+
+  const unsigned shift = magnitude - precision;
+
+  return ((shift + 1) << precision) + (value >> shift) - (1ULL << precision);
+}
+
+uint64_t
+histogram_t::value_of(size_t bucket) {
+  if(bucket < (1U << precision)) {
+    return bucket;
+  }
+
+  const unsigned shift = (bucket >> precision) - 1;
+  const uint64_t base = (bucket & ((1U << precision) - 1)) + (1U << precision);
+
+  // NOTE: Report the middle of the bucket.
+  return (base << shift) + ((1ULL << shift) >> 1);
+}
+
+meter_t::meter_t():
+  m_total(0),
+  m_last(-1.0),
+  m_rate(0.0)
+{ }
+
+void
+meter_t::tick(uint64_t total,
+              double now)
+{
+  if(m_last < 0.0) {
+    m_total = total;
+    m_last = now;
+    return;
+  }
+
+  const double elapsed = now - m_last;
+
+  if(elapsed <= 0.0) {
+    return;
+  }
+
+  const double instant = (total - m_total) / elapsed;
+  const double alpha = 1.0 - std::exp(-elapsed / 60.0);
+
+  m_rate += alpha * (instant - m_rate);
+  m_total = total;
+  m_last = now;
+}
+
+timeline_t::timeline_t():
+  m_started(clock_type::now()),
+  m_last(m_started)
+{ }
+
+void
+timeline_t::mark(const std::string& phase) {
+  const clock_type::time_point now = clock_type::now();
+
+  m_phases.push_back(std::make_pair(
+    phase,
+    std::chrono::duration<double, std::milli>(now - m_last).count()
+  ));
+
+  m_last = now;
+}
+
+double
+timeline_t::total() const {
+  return std::chrono::duration<double, std::milli>(m_last - m_started).count();
+}
+
+std::string
+timeline_t::format() const {
+  std::string result;
+
+  for(auto it = m_phases.begin(); it != m_phases.end(); ++it) {
+    if(!result.empty()) {
+      result += ' ';
+    }
+
+    result += cocaine::format("%s=%.3fms", it->first, it->second);
+  }
+
+  return result;
+}
+
+Json::Value
+timeline_t::snapshot() const {
+  Json::Value result(Json::objectValue);
+
+  for(auto it = m_phases.begin(); it != m_phases.end(); ++it) {
+    result[it->first] = it->second;
+  }
+
+  result["total"] = total();
+
+  return result;
+}
+
+metrics_t::metrics_t():
+  invokes(0),
+  chunks_in(0),
+  bytes_in(0),
+  chunks_out(0),
+  bytes_out(0),
+  steals(0),
+  reaped(0),
+  m_started(clock_type::now())
+{ }
+
+histogram_t&
+metrics_t::latency(const std::string& event) {
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  histogram_map_t::iterator it(m_latencies.find(event));
+
+  if(it == m_latencies.end()) {
+    it = m_latencies.insert(std::make_pair(
+      event,
+      std::unique_ptr<histogram_t>(new histogram_t())
+    )).first;
+  }
+
+  return *it->second;
+}
+
+void
+metrics_t::tick(double now) {
+  invoke_rate.tick(invokes.load(std::memory_order_relaxed), now);
+}
+
+Json::Value
+metrics_t::snapshot() const {
+  Json::Value result(Json::objectValue);
+
+  result["uptime"] = std::chrono::duration<double>(clock_type::now() - m_started).count();
+  result["invokes"] = static_cast<Json::UInt64>(invokes.load(std::memory_order_relaxed));
+  result["invoke-rate"] = invoke_rate.rate();
+  result["chunks-in"] = static_cast<Json::UInt64>(chunks_in.load(std::memory_order_relaxed));
+  result["bytes-in"] = static_cast<Json::UInt64>(bytes_in.load(std::memory_order_relaxed));
+  result["chunks-out"] = static_cast<Json::UInt64>(chunks_out.load(std::memory_order_relaxed));
+  result["bytes-out"] = static_cast<Json::UInt64>(bytes_out.load(std::memory_order_relaxed));
+  result["steals"] = static_cast<Json::UInt64>(steals.load(std::memory_order_relaxed));
+  result["reaped"] = static_cast<Json::UInt64>(reaped.load(std::memory_order_relaxed));
+  result["iteration-time"] = iteration_time.snapshot();
+
+  Json::Value& latencies(result["latency"] = Json::Value(Json::objectValue));
+
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  for(histogram_map_t::const_iterator it = m_latencies.begin(); it != m_latencies.end(); ++it) {
+    latencies[it->first] = it->second->snapshot();
+  }
+
+  return result;
+}
+
+metrics_socket_t::metrics_socket_t(reactor_t& reactor,
+                                   const std::string& path,
+                                   snapshot_t snapshot):
+  m_path(path),
+  m_snapshot(snapshot),
+  m_fd(::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0))
+{
+  if(m_fd < 0) {
+    throw cocaine::error_t("unable to create the metrics socket - %s", std::strerror(errno));
+  }
+
+  sockaddr_un address;
+
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+
+  if(m_path.size() >= sizeof(address.sun_path)) {
+    ::close(m_fd);
+    throw cocaine::error_t("the metrics socket path '%s' is too long", m_path);
+  }
+
+  std::strncpy(address.sun_path, m_path.c_str(), sizeof(address.sun_path) - 1);
+
+  // NOTE: A stale socket might be left behind by a crashed worker.
+  ::unlink(m_path.c_str());
+
+  if(::bind(m_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+     ::listen(m_fd, 16) != 0)
+  {
+    const int error = errno;
+
+    ::close(m_fd);
+
+    throw cocaine::error_t(
+      "unable to bind the metrics socket to '%s' - %s",
+      m_path,
+      std::strerror(error)
+    );
+  }
+
+  // NOTE: The metrics are best effort, so if polling fails, the socket just
+  // stops answering.
+  m_watcher.reset(new io_watcher_t(
+    reactor,
+    std::bind(&metrics_socket_t::on_accept, this),
+    [](const std::string&) { }
+  ));
+  m_watcher->start(m_fd);
+}
+
+metrics_socket_t::~metrics_socket_t() {
+  m_watcher.reset();
+
+  ::close(m_fd);
+  ::unlink(m_path.c_str());
+}
+
+void
+metrics_socket_t::on_accept() {
+  int client = -1;
+
+  while((client = ::accept4(m_fd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0) {
+    const std::string snapshot(m_snapshot());
+
+    // NOTE: The snapshot is small, so it fits into the socket buffer and a
+    // blocking write never waits for the client. Whatever fails is dropped.
+    ssize_t written = ::send(client, snapshot.data(), snapshot.size(), MSG_NOSIGNAL);
+
+    (void)written;
+
+    ::close(client);
+  }
+}
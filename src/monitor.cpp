@@ -0,0 +1,83 @@
+#include "monitor.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+#include <unistd.h>
+
+using namespace cocaine;
+using namespace cocaine::engine;
+
+loop_monitor_t::loop_monitor_t(reactor_t& reactor,
+                               histogram_t * iterations):
+  m_iterations(iterations),
+  m_started(clock_type::now()),
+  m_woken(m_started),
+  m_prepared(m_started),
+  m_busy(clock_type::duration::zero()),
+  m_longest(clock_type::duration::zero())
+{
+  m_prepare.reset(new prepare_watcher_t(reactor, std::bind(&loop_monitor_t::on_prepare, this)));
+  m_prepare->start();
+
+  m_check.reset(new check_watcher_t(reactor, std::bind(&loop_monitor_t::on_check, this)));
+  m_check->start();
+}
+
+loop_monitor_t::sample_t
+loop_monitor_t::sample() {
+  const clock_type::time_point now = clock_type::now();
+
+  // NOTE: The sample is usually taken from within a busy stretch, so its
+  // part so far is accounted here and the rest goes to the next sample.
+  const clock_type::duration current = now - m_woken,
+                             elapsed = now - m_started;
+
+  sample_t result = {
+    std::chrono::duration<double>(std::max(m_longest, current)).count(),
+    elapsed.count() > 0 ?
+      std::min(1.0, std::chrono::duration<double>(m_busy + current) / elapsed) :
+      0.0
+  };
+
+  m_started = now;
+  m_woken = now;
+  m_busy = clock_type::duration::zero();
+  m_longest = clock_type::duration::zero();
+
+  return result;
+}
+
+void
+loop_monitor_t::on_prepare() {
+  const clock_type::time_point now = clock_type::now();
+  const clock_type::duration stretch = now - m_woken;
+
+  m_busy += stretch;
+  m_longest = std::max(m_longest, stretch);
+
+  if(m_iterations) {
+    m_iterations->record(microseconds(now - m_prepared));
+  }
+
+  m_prepared = now;
+}
+
+void
+loop_monitor_t::on_check() {
+  m_woken = clock_type::now();
+}
+
+uint64_t
+cocaine::engine::resident_size() {
+  std::ifstream stream("/proc/self/statm");
+
+  uint64_t total = 0,
+           resident = 0;
+
+  if(!(stream >> total >> resident)) {
+    return 0;
+  }
+
+  return resident * ::sysconf(_SC_PAGESIZE);
+}
@@ -0,0 +1,81 @@
+#include "outbox.hpp"
+
+using namespace cocaine;
+using namespace cocaine::engine;
+
+outbox_t::outbox_t(io::unique_channel_t& channel,
+                   size_t high,
+                   size_t low,
+                   callback_t drain):
+  m_channel(channel),
+  m_bytes(high, low),
+  m_stalls(0),
+  m_drain(drain)
+{ }
+
+void
+outbox_t::append(zmq::message_t& frame,
+                 bool more)
+{
+  m_frames.emplace_back();
+
+  frame_t& queued = m_frames.back();
+
+  queued.message.move(&frame);
+  queued.size = queued.message.size();
+  queued.more = more;
+
+  m_bytes.acquire(queued.size);
+
+  // NOTE: The queue is sent in order, so if anything is left in there, this
+  // message is. Counted once per message rather than per flush attempt.
+  if(!more && !flush()) {
+    ++m_stalls;
+  }
+}
+
+bool
+outbox_t::flush() {
+  bool drained = false;
+
+  while(!m_frames.empty()) {
+    frame_t& frame = m_frames.front();
+
+    // NOTE: Once the first frame of a message is taken by ZeroMQ, the rest
+    // of it is taken as well regardless of the high water mark, so only the
+    // messages which haven't been started yet are left in the queue.
+    if(!m_channel.send(frame.message, (frame.more ? ZMQ_SNDMORE : 0) | ZMQ_DONTWAIT)) {
+      break;
+    }
+
+    drained = pop() || drained;
+  }
+
+  // NOTE: The callback is deferred till the queue is consistent, as it is
+  // likely to push more messages right away.
+  if(drained) {
+    m_drain();
+  }
+
+  return m_frames.empty();
+}
+
+void
+outbox_t::drain() {
+  while(!m_frames.empty()) {
+    frame_t& frame = m_frames.front();
+
+    m_channel.send(frame.message, frame.more ? ZMQ_SNDMORE : 0);
+
+    pop();
+  }
+}
+
+bool
+outbox_t::pop() {
+  const size_t size = m_frames.front().size;
+
+  m_frames.pop_front();
+
+  return m_bytes.release(size);
+}
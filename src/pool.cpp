@@ -0,0 +1,72 @@
+#include "pool.hpp"
+
+#include <algorithm>
+
+using namespace cocaine;
+using namespace cocaine::engine;
+
+pool_t::pool_t(size_t slab_size):
+  m_slab_size(slab_size),
+  m_hits(0),
+  m_misses(0)
+{
+  std::fill(m_free, m_free + classes, static_cast<node_t*>(nullptr));
+}
+
+pool_t::~pool_t() {
+  for(auto it = m_slabs.begin(); it != m_slabs.end(); ++it) {
+    ::operator delete(*it);
+  }
+}
+
+void*
+pool_t::allocate(size_t size) {
+  const size_t index = (std::max<size_t>(size, 1) - 1) / granularity;
+
+  if(index >= classes) {
+    ++m_misses;
+    return ::operator new(size);
+  }
+
+  if(!m_free[index]) {
+    const size_t block = (index + 1) * granularity;
+
+    char * slab = static_cast<char*>(::operator new(block * m_slab_size));
+
+    m_slabs.push_back(slab);
+
+    for(size_t i = m_slab_size; i > 0; --i) {
+      node_t * node = reinterpret_cast<node_t*>(slab + (i - 1) * block);
+
+      node->next = m_free[index];
+      m_free[index] = node;
+    }
+
+    ++m_misses;
+  } else {
+    ++m_hits;
+  }
+
+  node_t * node = m_free[index];
+
+  m_free[index] = node->next;
+
+  return node;
+}
+
+void
+pool_t::deallocate(void * block,
+                   size_t size)
+{
+  const size_t index = (std::max<size_t>(size, 1) - 1) / granularity;
+
+  if(index >= classes) {
+    ::operator delete(block);
+    return;
+  }
+
+  node_t * node = static_cast<node_t*>(block);
+
+  node->next = m_free[index];
+  m_free[index] = node;
+}
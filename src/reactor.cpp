@@ -0,0 +1,658 @@
+#include "reactor.hpp"
+
+using namespace cocaine;
+using namespace cocaine::engine;
+
+namespace {
+  template<class Handle>
+  void
+  on_uv_close(uv_handle_t* handle) {
+    delete reinterpret_cast<Handle*>(handle);
+  }
+
+  // NOTE: libuv handles must outlive their close request, so they are
+  // allocated separately and released from the close callback.
+  template<class Handle>
+  void
+  close(Handle * handle) {
+    if(handle) {
+      uv_close(reinterpret_cast<uv_handle_t*>(handle), &on_uv_close<Handle>);
+    }
+  }
+
+  uint64_t
+  milliseconds(double seconds) {
+    return static_cast<uint64_t>(seconds * 1000.0);
+  }
+
+  struct ev_loop*
+  make_ev_loop(reactor_t::backend_t backend,
+               bool primary)
+  {
+    if(primary || backend != reactor_t::backend_t::libev) {
+      return ev_default_loop(0);
+    }
+
+    return ev_loop_new(0);
+  }
+
+  uv_loop_t*
+  make_uv_loop(reactor_t::backend_t backend,
+               bool primary)
+  {
+    if(primary || backend != reactor_t::backend_t::libuv) {
+      return uv_default_loop();
+    }
+
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+    uv_loop_t * loop = new uv_loop_t;
+
+    uv_loop_init(loop);
+
+    return loop;
+#else
+    return uv_default_loop();
+#endif
+  }
+}
+
+reactor_t::reactor_t(backend_t backend,
+                     bool primary):
+  m_backend(backend),
+  m_primary(primary),
+  m_ev_loop(make_ev_loop(backend, primary)),
+  m_uv_loop(make_uv_loop(backend, primary))
+{ }
+
+reactor_t::~reactor_t() {
+  switch(m_backend) {
+    case backend_t::libev:
+      if(!m_primary) {
+        ev_loop_destroy(m_ev_loop.raw_loop);
+      }
+
+      break;
+
+    case backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      // NOTE: Runs the pending close callbacks of the watchers gone by now,
+      // on the shared loop as well, as nothing runs it after the worker.
+      uv_run(m_uv_loop, UV_RUN_NOWAIT);
+
+      if(!m_primary) {
+        uv_loop_close(m_uv_loop);
+        delete m_uv_loop;
+      }
+#endif
+
+      break;
+  }
+}
+
+void
+reactor_t::run() {
+  switch(m_backend) {
+    case backend_t::libev:
+      m_ev_loop.loop();
+      break;
+
+    case backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      uv_run(m_uv_loop, UV_RUN_DEFAULT);
+#endif
+      break;
+  }
+}
+
+void
+reactor_t::stop() {
+  switch(m_backend) {
+    case backend_t::libev:
+      m_ev_loop.unloop(ev::ALL);
+      break;
+
+    case backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      uv_stop(m_uv_loop);
+#endif
+      break;
+  }
+}
+
+void
+reactor_t::fork() {
+  switch(m_backend) {
+    case backend_t::libev:
+      ev_loop_fork(m_ev_loop.raw_loop);
+      break;
+
+    case backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LOOP_FORK
+      uv_loop_fork(m_uv_loop);
+#else
+      throw cocaine::error_t("the libuv event loop can't be forked before libuv 1.12");
+#endif
+      break;
+  }
+}
+
+double
+reactor_t::now() const {
+  if(m_backend == backend_t::libuv) {
+    return uv_now(m_uv_loop) / 1000.0;
+  }
+
+  return m_ev_loop.now();
+}
+
+io_watcher_t::io_watcher_t(reactor_t& reactor,
+                           callback_t callback,
+                           error_callback_t error):
+  m_reactor(reactor),
+  m_callback(callback),
+  m_error(error),
+  m_uv_poll_handle(nullptr)
+{
+  if(m_reactor.backend() == reactor_t::backend_t::libev) {
+    m_ev_watcher.set(m_reactor.ev_loop());
+    m_ev_watcher.set<io_watcher_t, &io_watcher_t::on_ev_event>(this);
+  }
+}
+
+io_watcher_t::~io_watcher_t() {
+  stop();
+
+  close(m_uv_poll_handle);
+}
+
+void
+io_watcher_t::start(int fd) {
+  switch(m_reactor.backend()) {
+    case reactor_t::backend_t::libev:
+      m_ev_watcher.start(fd, ev::READ);
+      break;
+
+    case reactor_t::backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      if(!m_uv_poll_handle) {
+        m_uv_poll_handle = new uv_poll_t;
+        m_uv_poll_handle->data = this;
+
+        uv_poll_init(m_reactor.uv_loop(), m_uv_poll_handle, fd);
+      }
+
+      uv_poll_start(m_uv_poll_handle, UV_READABLE, &io_watcher_t::on_uv_event);
+#endif
+
+      break;
+  }
+}
+
+void
+io_watcher_t::stop() {
+  switch(m_reactor.backend()) {
+    case reactor_t::backend_t::libev:
+      m_ev_watcher.stop();
+      break;
+
+    case reactor_t::backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      if(m_uv_poll_handle) {
+        uv_poll_stop(m_uv_poll_handle);
+      }
+#endif
+
+      break;
+  }
+}
+
+void
+io_watcher_t::on_ev_event(ev::io&, int) {
+  m_callback();
+}
+
+void
+io_watcher_t::on_uv_event(uv_poll_t* handle, int status, int) {
+  io_watcher_t * watcher = static_cast<io_watcher_t*>(handle->data);
+
+  if(status < 0) {
+    // NOTE: libuv keeps reporting the failure on every iteration otherwise.
+    watcher->stop();
+
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+    const std::string reason(uv_strerror(status));
+#else
+    const std::string reason("unknown error");
+#endif
+
+    if(watcher->m_error) {
+      watcher->m_error(reason);
+    } else {
+      watcher->m_reactor.stop();
+    }
+
+    return;
+  }
+
+  watcher->m_callback();
+}
+
+idle_watcher_t::idle_watcher_t(reactor_t& reactor,
+                               callback_t callback):
+  m_reactor(reactor),
+  m_callback(callback),
+  m_uv_handle(nullptr)
+{
+  switch(m_reactor.backend()) {
+    case reactor_t::backend_t::libev:
+      m_ev_watcher.set(m_reactor.ev_loop());
+      m_ev_watcher.set<idle_watcher_t, &idle_watcher_t::on_ev_event>(this);
+      break;
+
+    case reactor_t::backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      m_uv_handle = new uv_idle_t;
+      m_uv_handle->data = this;
+
+      uv_idle_init(m_reactor.uv_loop(), m_uv_handle);
+#endif
+
+      break;
+  }
+}
+
+idle_watcher_t::~idle_watcher_t() {
+  stop();
+  close(m_uv_handle);
+}
+
+void
+idle_watcher_t::start() {
+  switch(m_reactor.backend()) {
+    case reactor_t::backend_t::libev:
+      m_ev_watcher.start();
+      break;
+
+    case reactor_t::backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      uv_idle_start(m_uv_handle, &idle_watcher_t::on_uv_event);
+#endif
+      break;
+  }
+}
+
+void
+idle_watcher_t::stop() {
+  switch(m_reactor.backend()) {
+    case reactor_t::backend_t::libev:
+      m_ev_watcher.stop();
+      break;
+
+    case reactor_t::backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      uv_idle_stop(m_uv_handle);
+#endif
+      break;
+  }
+}
+
+void
+idle_watcher_t::on_ev_event(ev::idle&, int) {
+  m_callback();
+}
+
+void
+idle_watcher_t::on_uv_event(uv_idle_t* handle) {
+  static_cast<idle_watcher_t*>(handle->data)->m_callback();
+}
+
+prepare_watcher_t::prepare_watcher_t(reactor_t& reactor,
+                                     callback_t callback):
+  m_reactor(reactor),
+  m_callback(callback),
+  m_uv_handle(nullptr)
+{
+  switch(m_reactor.backend()) {
+    case reactor_t::backend_t::libev:
+      m_ev_watcher.set(m_reactor.ev_loop());
+      m_ev_watcher.set<prepare_watcher_t, &prepare_watcher_t::on_ev_event>(this);
+      break;
+
+    case reactor_t::backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      m_uv_handle = new uv_prepare_t;
+      m_uv_handle->data = this;
+
+      uv_prepare_init(m_reactor.uv_loop(), m_uv_handle);
+#endif
+
+      break;
+  }
+}
+
+prepare_watcher_t::~prepare_watcher_t() {
+  stop();
+  close(m_uv_handle);
+}
+
+void
+prepare_watcher_t::start() {
+  switch(m_reactor.backend()) {
+    case reactor_t::backend_t::libev:
+      m_ev_watcher.start();
+      break;
+
+    case reactor_t::backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      uv_prepare_start(m_uv_handle, &prepare_watcher_t::on_uv_event);
+#endif
+      break;
+  }
+}
+
+void
+prepare_watcher_t::stop() {
+  switch(m_reactor.backend()) {
+    case reactor_t::backend_t::libev:
+      m_ev_watcher.stop();
+      break;
+
+    case reactor_t::backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      uv_prepare_stop(m_uv_handle);
+#endif
+      break;
+  }
+}
+
+void
+prepare_watcher_t::on_ev_event(ev::prepare&, int) {
+  m_callback();
+}
+
+void
+prepare_watcher_t::on_uv_event(uv_prepare_t* handle) {
+  static_cast<prepare_watcher_t*>(handle->data)->m_callback();
+}
+
+check_watcher_t::check_watcher_t(reactor_t& reactor,
+                                     callback_t callback):
+  m_reactor(reactor),
+  m_callback(callback),
+  m_uv_handle(nullptr)
+{
+  switch(m_reactor.backend()) {
+    case reactor_t::backend_t::libev:
+      m_ev_watcher.set(m_reactor.ev_loop());
+      m_ev_watcher.set<check_watcher_t, &check_watcher_t::on_ev_event>(this);
+      break;
+
+    case reactor_t::backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      m_uv_handle = new uv_check_t;
+      m_uv_handle->data = this;
+
+      uv_check_init(m_reactor.uv_loop(), m_uv_handle);
+#endif
+
+      break;
+  }
+}
+
+check_watcher_t::~check_watcher_t() {
+  stop();
+  close(m_uv_handle);
+}
+
+void
+check_watcher_t::start() {
+  switch(m_reactor.backend()) {
+    case reactor_t::backend_t::libev:
+      m_ev_watcher.start();
+      break;
+
+    case reactor_t::backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      uv_check_start(m_uv_handle, &check_watcher_t::on_uv_event);
+#endif
+      break;
+  }
+}
+
+void
+check_watcher_t::stop() {
+  switch(m_reactor.backend()) {
+    case reactor_t::backend_t::libev:
+      m_ev_watcher.stop();
+      break;
+
+    case reactor_t::backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      uv_check_stop(m_uv_handle);
+#endif
+      break;
+  }
+}
+
+void
+check_watcher_t::on_ev_event(ev::check&, int) {
+  m_callback();
+}
+
+void
+check_watcher_t::on_uv_event(uv_check_t* handle) {
+  static_cast<check_watcher_t*>(handle->data)->m_callback();
+}
+
+async_watcher_t::async_watcher_t(reactor_t& reactor,
+                                 callback_t callback):
+  m_reactor(reactor),
+  m_callback(callback),
+  m_uv_handle(nullptr)
+{
+  switch(m_reactor.backend()) {
+    case reactor_t::backend_t::libev:
+      m_ev_watcher.set(m_reactor.ev_loop());
+      m_ev_watcher.set<async_watcher_t, &async_watcher_t::on_ev_event>(this);
+      m_ev_watcher.start();
+
+      break;
+
+    case reactor_t::backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      m_uv_handle = new uv_async_t;
+      m_uv_handle->data = this;
+
+      uv_async_init(m_reactor.uv_loop(), m_uv_handle, &async_watcher_t::on_uv_event);
+#endif
+
+      break;
+  }
+}
+
+async_watcher_t::~async_watcher_t() {
+  if(m_reactor.backend() == reactor_t::backend_t::libev) {
+    m_ev_watcher.stop();
+  }
+
+  close(m_uv_handle);
+}
+
+void
+async_watcher_t::send() {
+  switch(m_reactor.backend()) {
+    case reactor_t::backend_t::libev:
+      m_ev_watcher.send();
+      break;
+
+    case reactor_t::backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      uv_async_send(m_uv_handle);
+#endif
+      break;
+  }
+}
+
+void
+async_watcher_t::on_ev_event(ev::async&, int) {
+  m_callback();
+}
+
+void
+async_watcher_t::on_uv_event(uv_async_t* handle) {
+  static_cast<async_watcher_t*>(handle->data)->m_callback();
+}
+
+signal_watcher_t::signal_watcher_t(reactor_t& reactor,
+                                   callback_t callback):
+  m_reactor(reactor),
+  m_callback(callback),
+  m_uv_handle(nullptr)
+{
+  switch(m_reactor.backend()) {
+    case reactor_t::backend_t::libev:
+      m_ev_watcher.set(m_reactor.ev_loop());
+      m_ev_watcher.set<signal_watcher_t, &signal_watcher_t::on_ev_event>(this);
+      break;
+
+    case reactor_t::backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      m_uv_handle = new uv_signal_t;
+      m_uv_handle->data = this;
+
+      uv_signal_init(m_reactor.uv_loop(), m_uv_handle);
+#endif
+
+      break;
+  }
+}
+
+signal_watcher_t::~signal_watcher_t() {
+  stop();
+
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+  close(m_uv_handle);
+#endif
+}
+
+void
+signal_watcher_t::start(int signum) {
+  switch(m_reactor.backend()) {
+    case reactor_t::backend_t::libev:
+      m_ev_watcher.start(signum);
+      break;
+
+    case reactor_t::backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      uv_signal_start(m_uv_handle, &signal_watcher_t::on_uv_event, signum);
+#endif
+      break;
+  }
+}
+
+void
+signal_watcher_t::stop() {
+  switch(m_reactor.backend()) {
+    case reactor_t::backend_t::libev:
+      m_ev_watcher.stop();
+      break;
+
+    case reactor_t::backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      uv_signal_stop(m_uv_handle);
+#endif
+      break;
+  }
+}
+
+void
+signal_watcher_t::on_ev_event(ev::sig&, int) {
+  m_callback();
+}
+
+void
+signal_watcher_t::on_uv_event(uv_signal_t* handle, int) {
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+  static_cast<signal_watcher_t*>(handle->data)->m_callback();
+#else
+  (void)handle;
+#endif
+}
+
+timer_watcher_t::timer_watcher_t(reactor_t& reactor,
+                                 callback_t callback):
+  m_reactor(reactor),
+  m_callback(callback),
+  m_uv_handle(nullptr)
+{
+  switch(m_reactor.backend()) {
+    case reactor_t::backend_t::libev:
+      m_ev_watcher.set(m_reactor.ev_loop());
+      m_ev_watcher.set<timer_watcher_t, &timer_watcher_t::on_ev_event>(this);
+      break;
+
+    case reactor_t::backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      m_uv_handle = new uv_timer_t;
+      m_uv_handle->data = this;
+
+      uv_timer_init(m_reactor.uv_loop(), m_uv_handle);
+#endif
+
+      break;
+  }
+}
+
+timer_watcher_t::~timer_watcher_t() {
+  stop();
+  close(m_uv_handle);
+}
+
+void
+timer_watcher_t::start(double after,
+                       double repeat)
+{
+  switch(m_reactor.backend()) {
+    case reactor_t::backend_t::libev:
+      m_ev_watcher.stop();
+      m_ev_watcher.start(after, repeat);
+      break;
+
+    case reactor_t::backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      uv_timer_start(
+        m_uv_handle,
+        &timer_watcher_t::on_uv_event,
+        milliseconds(after),
+        milliseconds(repeat)
+      );
+#endif
+
+      break;
+  }
+}
+
+void
+timer_watcher_t::stop() {
+  switch(m_reactor.backend()) {
+    case reactor_t::backend_t::libev:
+      m_ev_watcher.stop();
+      break;
+
+    case reactor_t::backend_t::libuv:
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+      uv_timer_stop(m_uv_handle);
+#endif
+      break;
+  }
+}
+
+void
+timer_watcher_t::on_ev_event(ev::timer&, int) {
+  m_callback();
+}
+
+void
+timer_watcher_t::on_uv_event(uv_timer_t* handle) {
+  static_cast<timer_watcher_t*>(handle->data)->m_callback();
+}
@@ -0,0 +1,107 @@
+#include "settings.hpp"
+
+using namespace cocaine;
+using namespace cocaine::engine;
+
+settings_t::settings_t(const Json::Value& profile) {
+  const std::string loop(profile.get("event-loop", "libev").asString());
+
+  if(loop == "libev") {
+    backend = reactor_t::backend_t::libev;
+  } else if(loop == "libuv") {
+#ifdef COCAINE_WORKER_HAVE_LIBUV
+    backend = reactor_t::backend_t::libuv;
+#else
+    throw configuration_error_t("the libuv event loop requires Node.js with libuv 1.x");
+#endif
+  } else {
+    throw configuration_error_t("unknown event loop '%s'", loop);
+  }
+
+  io_bulk_size = profile.get("io-bulk-size", static_cast<Json::UInt>(defaults::io_bulk_size)).asUInt();
+  io_bulk_min = profile.get("io-bulk-min", static_cast<Json::UInt>(io_bulk_size / 10 + 1)).asUInt();
+  io_bulk_max = profile.get("io-bulk-max", static_cast<Json::UInt>(io_bulk_size * 10)).asUInt();
+  io_bulk_time = profile.get("io-bulk-time", 0.01).asDouble();
+
+  if(io_bulk_min == 0 || io_bulk_min > io_bulk_size || io_bulk_size > io_bulk_max) {
+    throw configuration_error_t("io bulk size limits are inconsistent");
+  }
+
+  if(io_bulk_time <= 0.0) {
+    throw configuration_error_t("io bulk time must be positive");
+  }
+
+  heartbeat_interval = profile.get("heartbeat-interval", 5.0).asDouble();
+  heartbeat_load = profile.get("heartbeat-load", false).asBool();
+
+  if(heartbeat_interval <= 0.0) {
+    throw configuration_error_t("heartbeat interval must be positive");
+  }
+
+  chunk_coalesce_size = profile.get("chunk-coalesce-size", 0).asUInt();
+  sandbox_batching = profile.get("sandbox-batching", true).asBool();
+
+  shm_threshold = profile.get("shm-threshold", 0).asUInt();
+  shm_size = profile.get("shm-size", 16 << 20).asUInt();
+
+  if(shm_threshold && shm_size < 2 * shm_threshold) {
+    throw configuration_error_t("shared memory ring size must fit at least two chunks");
+  }
+  session_capacity = profile.get("session-capacity", 64).asUInt();
+
+  session_idle_timeout = profile.get("session-idle-timeout", 0.0).asDouble();
+  session_timeout = profile.get("session-timeout", 0.0).asDouble();
+
+  if(session_idle_timeout < 0.0 || session_timeout < 0.0) {
+    throw configuration_error_t("session timeouts must not be negative");
+  }
+
+  drain_timeout = profile.get("drain-timeout", 5.0).asDouble();
+
+  if(drain_timeout < 0.0) {
+    throw configuration_error_t("drain timeout must not be negative");
+  }
+
+  session_inflight_high = profile.get("session-inflight-high", 0).asUInt();
+  session_inflight_low = profile.get("session-inflight-low", static_cast<Json::UInt>(session_inflight_high / 2)).asUInt();
+  worker_inflight_high = profile.get("worker-inflight-high", 0).asUInt();
+  worker_inflight_low = profile.get("worker-inflight-low", static_cast<Json::UInt>(worker_inflight_high / 2)).asUInt();
+
+  if((session_inflight_high && session_inflight_low >= session_inflight_high) ||
+     (worker_inflight_high && worker_inflight_low >= worker_inflight_high))
+  {
+    throw configuration_error_t("inflight low watermarks must be below the high ones");
+  }
+
+  outbound_queue_high = profile.get("outbound-queue-high", 4 << 20).asUInt();
+  outbound_queue_low = profile.get("outbound-queue-low", static_cast<Json::UInt>(outbound_queue_high / 2)).asUInt();
+
+  if(outbound_queue_low >= outbound_queue_high) {
+    throw configuration_error_t("outbound queue low watermark must be below the high one");
+  }
+
+  threads = profile.get("threads", 1).asUInt();
+  thread_queue_size = profile.get("thread-queue-size", 4096).asUInt();
+
+  if(threads == 0 || thread_queue_size == 0) {
+    throw configuration_error_t("thread count and queue size must be positive");
+  }
+
+  zygote = profile.get("zygote", false).asBool();
+  zygote_preload = profile.get("zygote-preload", threads == 1).asBool();
+  metrics = profile.get("metrics", false).asBool();
+
+  const std::string mode(profile.get("trace", "log").asString());
+
+  if(mode == "off") {
+    trace = tracer_t::mode_t::off;
+  } else if(mode == "log") {
+    trace = tracer_t::mode_t::log;
+  } else if(mode == "ring") {
+    trace = tracer_t::mode_t::ring;
+  } else {
+    throw configuration_error_t("unknown trace mode '%s'", mode);
+  }
+
+  trace_ring_size = profile.get("trace-ring-size", 4096).asUInt();
+}
@@ -0,0 +1,433 @@
+#include "shard.hpp"
+
+#include <cocaine/rpc.hpp>
+
+#include <cocaine/api/sandbox.hpp>
+
+using namespace cocaine;
+using namespace cocaine::engine;
+using namespace cocaine::io;
+
+namespace {
+  // Sessions started per loop iteration, so that the commands for the
+  // running ones don't wait for a whole burst of invokes.
+  const size_t batch = 64;
+}
+
+shard_t::shard_t(const settings_t& settings,
+                 metrics_t& metrics,
+                 dispatcher_t& dispatcher,
+                 size_t index,
+                 size_t shares,
+                 factory_t factory,
+                 callback_t notify,
+                 side_channel_t * side):
+  m_settings(settings),
+  m_metrics(metrics),
+  m_dispatcher(dispatcher),
+  m_index(index),
+  m_shares(shares),
+  m_factory(factory),
+  m_notify(notify),
+  m_side(side),
+  m_commands(settings.thread_queue_size),
+  m_dirty(false),
+  m_retired(false),
+  m_overflowed(false),
+  m_replies(settings.thread_queue_size),
+  m_waiting(false),
+  m_stopping(false),
+  m_congested(false),
+  m_idle(true),
+  m_sessions(0),
+  m_inflight(0),
+  m_open(0),
+  m_pool_hits(0),
+  m_pool_misses(0),
+  m_retiring(false),
+  m_started(false),
+  m_thread(&shard_t::run, this)
+{
+  boost::unique_lock<boost::mutex> lock(m_mutex);
+
+  while(!m_started) {
+    m_condition.wait(lock);
+  }
+
+  if(!m_error.empty()) {
+    lock.unlock();
+    m_thread.join();
+
+    throw cocaine::error_t("unable to start a sandbox thread - %s", m_error);
+  }
+}
+
+shard_t::~shard_t() {
+  m_stopping.store(true, std::memory_order_release);
+  m_wakeup->send();
+
+  m_thread.join();
+
+  command_t * command = nullptr;
+  reply_t * reply = nullptr;
+
+  while(m_commands.pop(command)) {
+    delete command;
+  }
+
+  while(m_replies.pop(reply)) {
+    delete reply;
+  }
+
+  for(auto it = m_overflow.begin(); it != m_overflow.end(); ++it) {
+    delete *it;
+  }
+
+  for(auto it = m_backlog.begin(); it != m_backlog.end(); ++it) {
+    delete *it;
+  }
+}
+
+void
+shard_t::invoke(const boost::shared_ptr<pending_t>& session) {
+  m_dispatcher.push(m_index, session);
+  m_dirty = true;
+}
+
+void
+shard_t::chunk(const unique_id_t& session_id,
+               zmq::message_t& frame)
+{
+  command_t * command = new command_t(event_traits<rpc::chunk>::id, session_id);
+
+  command->frame.move(&frame);
+
+  post(command);
+}
+
+void
+shard_t::choke(const unique_id_t& session_id) {
+  post(new command_t(event_traits<rpc::choke>::id, session_id));
+}
+
+void
+shard_t::retire() {
+  post(new command_t(event_traits<rpc::terminate>::id, unique_id_t(uninitialized)));
+}
+
+void
+shard_t::abort() {
+  post(new command_t(event_traits<rpc::error>::id, unique_id_t(uninitialized)));
+}
+
+void
+shard_t::poke() {
+  if(m_idle.exchange(false)) {
+    m_wakeup->send();
+  }
+}
+
+void
+shard_t::commit() {
+  while(!m_overflow.empty()) {
+    if(!m_commands.push(m_overflow.front())) {
+      m_overflowed.store(true, std::memory_order_release);
+
+      // NOTE: The shard might have emptied the ring before the flag was
+      // raised, in which case nobody is going to notify us.
+      if(!m_commands.push(m_overflow.front())) {
+        break;
+      }
+    }
+
+    m_overflow.pop_front();
+    m_dirty = true;
+  }
+
+  if(m_dirty) {
+    m_dirty = false;
+    m_wakeup->send();
+  }
+}
+
+void
+shard_t::collect(outbox_t& outbox,
+                 std::vector<unique_id_t>& expired)
+{
+  reply_t * reply = nullptr;
+
+  while(!outbox.congested() && m_replies.pop(reply)) {
+    if(reply->retired) {
+      m_retired = true;
+    } else if(reply->count == 0) {
+      expired.push_back(reply->session_id);
+    }
+
+    for(size_t i = 0; i < reply->count; ++i) {
+      outbox.append(reply->frames[i], i + 1 < reply->count);
+    }
+
+    delete reply;
+  }
+
+  // NOTE: With the ring still full, the shard can't make any progress, so
+  // there is no point in waking it up yet.
+  if(m_replies.size() < m_replies.capacity() && m_waiting.exchange(false)) {
+    m_wakeup->send();
+  }
+}
+
+void
+shard_t::send(zmq::message_t * frames,
+              size_t count)
+{
+  BOOST_ASSERT(count <= 4);
+
+  reply_t * reply = new reply_t;
+
+  for(size_t i = 0; i < count; ++i) {
+    reply->frames[i].move(&frames[i]);
+  }
+
+  reply->count = count;
+
+  this->reply(reply);
+}
+
+void
+shard_t::expired(const unique_id_t& session_id) {
+  reply_t * reply = new reply_t;
+
+  reply->session_id = session_id;
+
+  this->reply(reply);
+}
+
+bool
+shard_t::writable() const {
+  const size_t limit = m_replies.capacity() / 2;
+
+  if(m_backlog.empty() && m_replies.size() < limit) {
+    return true;
+  }
+
+  m_waiting.store(true, std::memory_order_release);
+
+  // NOTE: The worker thread might have collected everything before the
+  // flag was raised.
+  return m_backlog.empty() && m_replies.size() < limit;
+}
+
+void
+shard_t::post(command_t * command) {
+  if(m_overflow.empty() && m_commands.push(command)) {
+    m_dirty = true;
+  } else {
+    m_overflow.push_back(command);
+  }
+}
+
+void
+shard_t::run() {
+  std::string error;
+
+  try {
+    m_reactor.reset(new reactor_t(m_settings.backend, false));
+    m_wakeup.reset(new async_watcher_t(*m_reactor, std::bind(&shard_t::on_wakeup, this)));
+    m_retirer.reset(new prepare_watcher_t(*m_reactor, std::bind(&shard_t::on_retire, this)));
+
+    m_executor.reset(new executor_t(
+      *m_reactor,
+      *this,
+      m_factory(),
+      m_settings,
+      m_metrics,
+      m_shares,
+      std::bind(&shard_t::on_resume, this),
+      m_side
+    ));
+  } catch(const std::exception& e) {
+    error = e.what();
+  } catch(...) {
+    error = "unexpected exception";
+  }
+
+  {
+    boost::lock_guard<boost::mutex> guard(m_mutex);
+
+    m_started = true;
+    m_error = error.empty() && !m_executor ? "unknown error" : error;
+  }
+
+  m_condition.notify_one();
+
+  if(!m_executor) {
+    return;
+  }
+
+  m_reactor->run();
+
+  // NOTE: The sandbox is destroyed on its own thread, while the loop and
+  // the wakeup watcher are left for the destructor, which might still be
+  // sending wakeups.
+  m_executor.reset();
+}
+
+void
+shard_t::reply(reply_t * reply) {
+  if(!m_backlog.empty() || !m_replies.push(reply)) {
+    m_backlog.push_back(reply);
+    m_waiting.store(true, std::memory_order_release);
+  }
+
+  m_notify();
+}
+
+void
+shard_t::on_wakeup() {
+  if(m_stopping.load(std::memory_order_acquire)) {
+    m_reactor->stop();
+    return;
+  }
+
+  bool moved = false;
+
+  while(!m_backlog.empty() && m_replies.push(m_backlog.front())) {
+    m_backlog.pop_front();
+    moved = true;
+  }
+
+  if(!m_backlog.empty()) {
+    m_waiting.store(true, std::memory_order_release);
+  }
+
+  if(moved) {
+    m_notify();
+  }
+
+  command_t * command = nullptr;
+
+  while(m_commands.pop(command)) {
+    const std::unique_ptr<command_t> guard(command);
+
+    switch(command->type) {
+      case event_traits<rpc::chunk>::id:
+        m_executor->chunk(command->session_id, command->frame);
+        break;
+
+      case event_traits<rpc::choke>::id:
+        m_executor->choke(command->session_id);
+        break;
+
+      case event_traits<rpc::terminate>::id:
+        // NOTE: The sessions are closed by the sandbox callbacks, so they
+        // are checked on every loop iteration from now on.
+        m_retiring = true;
+        m_retirer->start();
+        break;
+
+      case event_traits<rpc::error>::id:
+        m_executor->abort(resource_error, "the worker is shutting down");
+        break;
+    }
+  }
+
+  if(m_overflowed.exchange(false)) {
+    m_notify();
+  }
+
+  size_t started = 0;
+
+  boost::shared_ptr<pending_t> session;
+
+  while(started < batch && (session = m_dispatcher.take(m_index))) {
+    start(*session);
+    ++started;
+  }
+
+  // NOTE: Only a single session is stolen per loop iteration, so that the
+  // shards which are keeping up get to start theirs in the meantime.
+  if(started == 0 && !m_retiring && !m_executor->congested() && (session = m_dispatcher.steal(m_index))) {
+    m_metrics.steals.fetch_add(1, std::memory_order_relaxed);
+
+    start(*session);
+    ++started;
+  }
+
+  if(started != 0) {
+    // Come back for the rest on the next loop iteration.
+    m_wakeup->send();
+  } else {
+    m_idle.store(true, std::memory_order_release);
+  }
+
+  publish();
+
+  if(writable()) {
+    m_executor->drained();
+  }
+}
+
+void
+shard_t::on_resume() {
+  // NOTE: This might be called while the executor is being destroyed, so
+  // it isn't touched here.
+  m_congested.store(false, std::memory_order_release);
+  m_notify();
+}
+
+void
+shard_t::start(pending_t& session) {
+  m_executor->invoke(session.session_id, session.event);
+
+  for(auto it = session.chunks.begin(); it != session.chunks.end(); ++it) {
+    m_executor->chunk(session.session_id, **it);
+  }
+
+  session.chunks.clear();
+
+  // NOTE: The executor has charged the chunks against its own budget by now,
+  // so the worker may resume reading if they have been holding it back.
+  if(m_dispatcher.release(session)) {
+    m_notify();
+  }
+
+  if(session.choked) {
+    m_executor->choke(session.session_id);
+  }
+}
+
+void
+shard_t::on_retire() {
+  // NOTE: Keeps the count of the open sessions fresh for the worker thread,
+  // which reports it if the shard doesn't make it in time.
+  publish();
+
+  // NOTE: The queued sessions are started as usual, but no more are stolen.
+  if(m_executor->open() != 0 || m_dispatcher.depth(m_index) != 0) {
+    return;
+  }
+
+  m_retirer->stop();
+
+  reply_t * reply = new reply_t;
+
+  reply->retired = true;
+
+  this->reply(reply);
+}
+
+void
+shard_t::publish() {
+  const bool congested = m_executor->congested();
+
+  m_sessions.store(m_executor->sessions(), std::memory_order_relaxed);
+  m_inflight.store(m_executor->inflight(), std::memory_order_relaxed);
+  m_open.store(m_executor->open(), std::memory_order_relaxed);
+  m_pool_hits.store(m_executor->pool().hits(), std::memory_order_relaxed);
+  m_pool_misses.store(m_executor->pool().misses(), std::memory_order_relaxed);
+
+  if(m_congested.exchange(congested) && !congested) {
+    m_notify();
+  }
+}
@@ -0,0 +1,328 @@
+#include "shm.hpp"
+
+#include <cstring>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace cocaine;
+using namespace cocaine::engine;
+
+namespace {
+  struct record_t {
+    enum state_t: uint32_t {
+      free,
+      written,
+      released
+    };
+
+    std::atomic<uint32_t> state;
+    uint32_t size;
+  };
+
+  // NOTE: The header takes a whole alignment unit, so that the rings start
+  // aligned as well.
+  struct header_t {
+    uint64_t magic;
+    uint64_t size;
+  };
+
+  const uint64_t magic = 0x636f6361696e6531ULL;
+
+  uint64_t
+  align(uint64_t size) {
+    return (size + shm_ring_t::alignment - 1) & ~static_cast<uint64_t>(shm_ring_t::alignment - 1);
+  }
+
+  record_t*
+  record_at(char * base,
+            uint64_t offset)
+  {
+    return reinterpret_cast<record_t*>(base + offset);
+  }
+
+  size_t
+  ring_size(int fd) {
+    struct stat info;
+
+    if(::fstat(fd, &info) != 0) {
+      ::close(fd);
+      throw cocaine::error_t("unable to inspect the shared memory segment - %s", std::strerror(errno));
+    }
+
+    const uint64_t total = info.st_size;
+
+    if(total <= shm_ring_t::alignment || (total - shm_ring_t::alignment) % (2 * shm_ring_t::alignment)) {
+      ::close(fd);
+      throw cocaine::error_t("the shared memory segment is malformed");
+    }
+
+    return (total - shm_ring_t::alignment) / 2;
+  }
+
+  void
+  on_release(void * data,
+             void *)
+  {
+    shm_ring_t::release(static_cast<char*>(data));
+  }
+}
+
+shm_ring_t::shm_ring_t(char * base,
+                       size_t size):
+  m_base(base),
+  m_size(size),
+  m_head(0),
+  m_tail(0)
+{
+  BOOST_ASSERT(m_size % alignment == 0);
+}
+
+bool
+shm_ring_t::write(const char * data,
+                  size_t size,
+                  uint64_t& offset)
+{
+  const uint64_t span = align(sizeof(record_t) + size);
+
+  if(span > m_size || size > std::numeric_limits<uint32_t>::max()) {
+    return false;
+  }
+
+  reclaim();
+
+  uint64_t at = m_head % m_size;
+
+  // NOTE: Records never wrap around, the end of the ring is skipped over
+  // with a padding record instead, which is released right away.
+  const uint64_t padding = at + span > m_size ? m_size - at : 0;
+
+  if(m_head - m_tail + padding + span > m_size) {
+    return false;
+  }
+
+  if(padding) {
+    record_t * record = record_at(m_base, at);
+
+    record->size = padding - sizeof(record_t);
+    record->state.store(record_t::released, std::memory_order_relaxed);
+
+    m_head += padding;
+    at = 0;
+  }
+
+  record_t * record = record_at(m_base, at);
+
+  record->size = size;
+  std::memcpy(reinterpret_cast<char*>(record + 1), data, size);
+  record->state.store(record_t::written, std::memory_order_release);
+
+  m_head += span;
+  offset = at;
+
+  return true;
+}
+
+char*
+shm_ring_t::read(uint64_t offset,
+                 uint64_t size) const
+{
+  if(offset % alignment || offset >= m_size || size > m_size - offset - sizeof(record_t)) {
+    return nullptr;
+  }
+
+  record_t * record = record_at(m_base, offset);
+
+  if(record->state.load(std::memory_order_acquire) != record_t::written || record->size != size) {
+    return nullptr;
+  }
+
+  return reinterpret_cast<char*>(record + 1);
+}
+
+void
+shm_ring_t::release(char * data) {
+  record_t * record = reinterpret_cast<record_t*>(data) - 1;
+
+  record->state.store(record_t::released, std::memory_order_release);
+}
+
+void
+shm_ring_t::reclaim() {
+  while(m_tail != m_head) {
+    record_t * record = record_at(m_base, m_tail % m_size);
+
+    if(record->state.load(std::memory_order_acquire) != record_t::released) {
+      break;
+    }
+
+    record->state.store(record_t::free, std::memory_order_relaxed);
+    m_tail += align(sizeof(record_t) + record->size);
+  }
+}
+
+side_channel_t::side_channel_t(const std::string& name,
+                               size_t size):
+  m_name(name),
+  m_size(size - size % shm_ring_t::alignment),
+  m_owner(true),
+  m_linked(false),
+  m_accepted(false),
+  m_base(nullptr)
+{
+  if(m_size == 0) {
+    throw cocaine::error_t("the shared memory ring size is too small");
+  }
+
+  const int fd = ::shm_open(m_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+
+  if(fd < 0) {
+    throw cocaine::error_t(
+      "unable to create the shared memory segment '%s' - %s",
+      m_name,
+      std::strerror(errno)
+    );
+  }
+
+  m_linked = true;
+
+  try {
+    if(::ftruncate(fd, shm_ring_t::alignment + 2 * m_size) != 0) {
+      ::close(fd);
+      throw cocaine::error_t("unable to size the shared memory segment - %s", std::strerror(errno));
+    }
+
+    map(fd);
+  } catch(...) {
+    ::shm_unlink(m_name.c_str());
+    throw;
+  }
+
+  header_t * header = static_cast<header_t*>(m_base);
+
+  header->magic = magic;
+  header->size = m_size;
+}
+
+side_channel_t::side_channel_t(const std::string& name,
+                               int fd):
+  m_name(name),
+  m_size(ring_size(fd)),
+  m_owner(false),
+  m_linked(false),
+  m_accepted(false),
+  m_base(nullptr)
+{
+  map(fd);
+
+  const header_t * header = static_cast<const header_t*>(m_base);
+
+  if(header->magic != magic || header->size != m_size) {
+    ::munmap(m_base, shm_ring_t::alignment + 2 * m_size);
+    throw cocaine::error_t("the shared memory segment '%s' is malformed", m_name);
+  }
+}
+
+side_channel_t::~side_channel_t() {
+  m_incoming.reset();
+  m_outgoing.reset();
+
+  ::munmap(m_base, shm_ring_t::alignment + 2 * m_size);
+
+  if(m_linked) {
+    ::shm_unlink(m_name.c_str());
+  }
+}
+
+std::unique_ptr<side_channel_t>
+side_channel_t::open(const std::string& name) {
+  const int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+
+  if(fd < 0) {
+    throw cocaine::error_t(
+      "unable to open the shared memory segment '%s' - %s",
+      name,
+      std::strerror(errno)
+    );
+  }
+
+  return std::unique_ptr<side_channel_t>(new side_channel_t(name, fd));
+}
+
+void
+side_channel_t::accept() {
+  // NOTE: Both sides have the segment mapped by now, so the name is of no
+  // use anymore, and removing it early leaves nothing behind on a crash.
+  unlink();
+
+  m_accepted.store(true, std::memory_order_release);
+}
+
+void
+side_channel_t::unlink() {
+  if(m_linked) {
+    ::shm_unlink(m_name.c_str());
+    m_linked = false;
+  }
+}
+
+bool
+side_channel_t::write(const char * data,
+                      size_t size,
+                      uint64_t& offset)
+{
+  if(!accepted()) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  return m_outgoing->write(data, size, offset);
+}
+
+bool
+side_channel_t::read(uint64_t offset,
+                     uint64_t size,
+                     zmq::message_t& frame)
+{
+  char * data = m_incoming->read(offset, size);
+
+  if(!data) {
+    return false;
+  }
+
+  frame.rebuild(data, size, &on_release, nullptr);
+
+  return true;
+}
+
+void
+side_channel_t::map(int fd) {
+  const size_t total = shm_ring_t::alignment + 2 * m_size;
+
+  m_base = ::mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  ::close(fd);
+
+  if(m_base == MAP_FAILED) {
+    throw cocaine::error_t("unable to map the shared memory segment - %s", std::strerror(errno));
+  }
+
+  // NOTE: The first ring goes from the engine to the worker, the second one
+  // the other way around.
+  char * rings = static_cast<char*>(m_base) + shm_ring_t::alignment;
+
+  std::unique_ptr<shm_ring_t> first(new shm_ring_t(rings, m_size)),
+                              second(new shm_ring_t(rings + m_size, m_size));
+
+  if(m_owner) {
+    m_incoming = std::move(first);
+    m_outgoing = std::move(second);
+  } else {
+    m_incoming = std::move(second);
+    m_outgoing = std::move(first);
+  }
+}
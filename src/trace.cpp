@@ -0,0 +1,95 @@
+#include "trace.hpp"
+
+using namespace cocaine;
+using namespace cocaine::engine;
+
+namespace {
+  const char*
+  describe(trace_event_t event) {
+    switch(event) {
+      case trace_event_t::received:
+        return "%s received type %d message";
+    }
+
+    return "%s traced unknown event %d";
+  }
+}
+
+tracer_t::tracer_t(logging::log_t * log,
+                   const std::string& source,
+                   mode_t mode,
+                   size_t ring_size):
+  m_log(log),
+  m_source(source),
+  m_mode(mode),
+  m_position(0)
+{
+  if(m_mode == mode_t::ring) {
+    size_t size = 1;
+
+    while(size < ring_size) {
+      size <<= 1;
+    }
+
+    m_ring.resize(size);
+  }
+}
+
+void
+tracer_t::record(logging::priorities level,
+                 trace_event_t event,
+                 int64_t argument)
+{
+  switch(m_mode) {
+    case mode_t::log:
+      COCAINE_LOG(m_log, level, describe(event), m_source, argument);
+      break;
+
+    case mode_t::ring: {
+      record_t& record = m_ring[m_position++ & (m_ring.size() - 1)];
+
+      record.timestamp = clock_type::now().time_since_epoch().count();
+      record.event = event;
+      record.level = level;
+      record.argument = argument;
+
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+void
+tracer_t::dump() {
+  if(m_mode != mode_t::ring) {
+    return;
+  }
+
+  const uint64_t size = m_ring.size();
+  const uint64_t count = std::min(m_position, size);
+
+  COCAINE_LOG_INFO(m_log, "%s dumping %llu trace records", m_source, count);
+
+  if(!count) {
+    return;
+  }
+
+  const clock_type::rep last = m_ring[(m_position - 1) & (size - 1)].timestamp;
+
+  for(uint64_t i = m_position - count; i != m_position; ++i) {
+    const record_t& record = m_ring[i & (size - 1)];
+
+    const double age = std::chrono::duration<double>(
+      clock_type::duration(last - record.timestamp)
+    ).count();
+
+    COCAINE_LOG_INFO(
+      m_log,
+      "[-%.6fs] %s",
+      age,
+      cocaine::format(describe(record.event), m_source, record.argument)
+    );
+  }
+}
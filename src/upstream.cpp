@@ -0,0 +1,196 @@
+#include "upstream.hpp"
+#include "executor.hpp"
+
+using namespace cocaine;
+using namespace cocaine::engine;
+
+upstream_t::upstream_t(const unique_id_t& id,
+                       executor_t * const executor,
+                       size_t coalesce,
+                       histogram_t& latency):
+  m_id(id),
+  m_executor(executor),
+  m_state(state_t::open),
+  m_coalesce(coalesce),
+  m_latency(latency),
+  m_started(metrics_t::clock_type::now()),
+  m_activity(executor->tick())
+{ }
+
+upstream_t::~upstream_t() {
+  if(m_state != state_t::closed) {
+    close();
+  }
+}
+
+void
+upstream_t::push(const char * chunk,
+                 size_t size)
+{
+  switch(m_state) {
+    case state_t::open: {
+      m_activity = m_executor->tick();
+
+      if(coalesce(chunk, size)) {
+        break;
+      }
+
+      zmq::message_t frame;
+
+      pack_chunk(frame, chunk, size);
+      m_executor->send_chunk(m_id, frame);
+                
+      break;
+    }
+
+    case state_t::closed:
+      throw cocaine::error_t("the stream has been closed");
+  }
+}
+
+void
+upstream_t::push(char * chunk,
+                 size_t size,
+                 size_t headroom,
+                 release_t release,
+                 void * hint)
+{
+  switch(m_state) {
+    case state_t::open: {
+      m_activity = m_executor->tick();
+
+      bool coalesced = false;
+
+      try {
+        coalesced = coalesce(chunk, size);
+      } catch(...) {
+        release(chunk, hint);
+        throw;
+      }
+
+      if(coalesced) {
+        release(chunk, hint);
+        break;
+      }
+
+      zmq::message_t frame;
+
+      pack_chunk(frame, chunk, size, headroom, release, hint);
+      m_executor->send_chunk(m_id, frame);
+
+      break;
+    }
+
+    case state_t::closed:
+      release(chunk, hint);
+      throw cocaine::error_t("the stream has been closed");
+  }
+}
+
+void
+upstream_t::error(error_code code,
+                  const std::string& message)
+{
+  switch(m_state) {
+    case state_t::open:
+      flush();
+
+      m_state = state_t::closed;
+      m_latency.record(microseconds(metrics_t::clock_type::now() - m_started));
+
+      m_executor->send_error(m_id, static_cast<int>(code), message);
+      m_executor->send_choke(m_id);
+
+      break;
+
+    case state_t::closed:
+      throw cocaine::error_t("the stream has been closed");
+  }
+}
+
+void
+upstream_t::close() {
+  switch(m_state) {
+    case state_t::open:
+      flush();
+
+      m_state = state_t::closed;
+      m_latency.record(microseconds(metrics_t::clock_type::now() - m_started));
+
+      m_executor->send_choke(m_id);
+
+      break;
+
+    case state_t::closed:
+      throw cocaine::error_t("the stream has been closed");
+  }
+}
+
+bool
+upstream_t::writable() const {
+  return m_executor->writable();
+}
+
+void
+upstream_t::on_drain(callback_t callback) {
+  if(m_executor->writable()) {
+    callback();
+    return;
+  }
+
+  if(!m_drain) {
+    m_executor->wait_drain(shared_from_this());
+  }
+
+  m_drain = callback;
+}
+
+void
+upstream_t::drained() {
+  callback_t callback;
+
+  callback.swap(m_drain);
+
+  if(callback) {
+    callback();
+  }
+}
+
+void
+upstream_t::flush() {
+  if(m_pending.empty()) {
+    return;
+  }
+
+  zmq::message_t frame;
+
+  pack_chunk(frame, m_pending.data(), m_pending.size());
+  m_executor->recycle_buffer(m_pending);
+
+  m_executor->send_chunk(m_id, frame);
+}
+
+bool
+upstream_t::coalesce(const char * chunk,
+                     size_t size)
+{
+  if(size >= m_coalesce) {
+    // NOTE: Large chunks go out on their own, but never ahead of the bytes
+    // which have been pushed before them.
+    flush();
+    return false;
+  }
+
+  if(m_pending.empty()) {
+    m_executor->take_buffer(m_pending);
+    m_executor->defer(shared_from_this());
+  }
+
+  m_pending.append(chunk, size);
+
+  if(m_pending.size() >= m_coalesce) {
+    flush();
+  }
+
+  return true;
+}
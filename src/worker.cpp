@@ -11,6 +11,10 @@
 #include <cocaine/traits/unique_id.hpp>
 
 #include <boost/filesystem/path.hpp>
+#include <boost/make_shared.hpp>
+
+#include <csignal>
+#include <limits>
 
 using namespace cocaine;
 using namespace cocaine::engine;
@@ -20,90 +24,9 @@ using namespace cocaine::logging;
 namespace fs = boost::filesystem;
 
 namespace {
-  struct upstream_t:
-    public api::stream_t
-  {
-    upstream_t(const unique_id_t& id,
-               worker_t * const worker):
-      m_id(id),
-      m_worker(worker),
-      m_state(state_t::open)
-      { }
-
-    virtual
-    ~upstream_t() {
-      if(m_state != state_t::closed) {
-        close();
-      }
-    }
-
-    virtual
-    void
-    push(const char * chunk,
-         size_t size) {
-      switch(m_state) {
-        case state_t::open:
-          send<rpc::chunk>(std::string(chunk, size));
-                    
-          break;
-
-        case state_t::closed:
-          throw cocaine::error_t("the stream has been closed");
-      }
-    }
-
-    virtual
-    void
-    error(error_code code,
-          const std::string& message) {
-      switch(m_state) {
-        case state_t::open:
-          m_state = state_t::closed;
-
-          send<rpc::error>(static_cast<int>(code), message);
-          send<rpc::choke>();
-
-          break;
-
-        case state_t::closed:
-          throw cocaine::error_t("the stream has been closed");
-      }
-    }
-
-    virtual
-    void
-    close() {
-      switch(m_state) {
-        case state_t::open:
-          m_state = state_t::closed;
-
-          send<rpc::choke>();
-
-          break;
-
-        case state_t::closed:
-          throw cocaine::error_t("the stream has been closed");
-      }
-    }
-
-  private:
-    template<class Event, typename... Args>
-    void
-    send(Args&&... args) {
-      m_worker->send<Event>(m_id, std::forward<Args>(args)...);
-    }
-
-  private:
-    const unique_id_t m_id;
-    worker_t * const m_worker;
-
-    enum class state_t: int {
-      open,
-        closed
-        };
-
-    state_t m_state;
-  };
+  // Seconds the shards are given to fail their sessions after the drain
+  // timeout, see worker_t::on_retire_timeout().
+  const double abort_timeout = 1.0;
 }
 
 worker_t::worker_t(context_t& context,
@@ -111,7 +34,14 @@ worker_t::worker_t(context_t& context,
   m_context(context),
   m_log(new log_t(context, cocaine::format("app/%s", config.app))),
   m_id(config.uuid),
-  m_channel(context, ZMQ_DEALER, m_id)
+  m_channel(context, ZMQ_DEALER, m_id),
+  m_readiness(readiness_t::processing),
+  m_retiring(false),
+  m_aborting(false),
+  m_protocol(*this),
+  m_next(0),
+  m_stats(),
+  m_startup(config.startup)
 {
   std::string endpoint = cocaine::format(
     "ipc://%1%/engines/%2%",
@@ -120,32 +50,102 @@ worker_t::worker_t(context_t& context,
     
   m_channel.connect(endpoint);
 
-  m_uv_poll_handle_ = new uv_poll_t;
-  m_uv_poll_handle_->data = this;
-  
-  m_watcher.set<worker_t, &worker_t::on_event>(this);
-  m_watcher.start(m_channel.fd(), ev::READ);
-  m_checker.set<worker_t, &worker_t::on_check>(this);
-  m_checker.start();
-
-  m_heartbeat_timer.set<worker_t, &worker_t::on_heartbeat>(this);
-  m_heartbeat_timer.start(0.0f, 5.0f);
+  m_startup.mark("connect");
 
   // Launching the app
 
   try {
-    m_manifest.reset(new manifest_t(m_context, config.app));
-    m_profile.reset(new profile_t(m_context, config.profile));
+    if(config.preload) {
+      m_manifest = std::move(config.preload->manifest);
+      m_profile = std::move(config.preload->profile);
+      m_settings = std::move(config.preload->settings);
+      m_reactor = std::move(config.preload->reactor);
+    }
+
+    if(!m_manifest) {
+      m_manifest.reset(new manifest_t(m_context, config.app));
+      m_startup.mark("manifest");
+    }
+
+    if(!m_profile) {
+      m_profile.reset(new profile_t(m_context, config.profile));
+      m_settings.reset(new settings_t(*m_profile));
+      m_startup.mark("profile");
+    }
+
+    if(!m_reactor) {
+      // NOTE: The reactor has to exist before the sandbox is loaded, so that
+      // a libuv-backed worker shares its loop with the Node.js runtime.
+      m_reactor.reset(new reactor_t(m_settings->backend));
+    }
         
-    fs::path path = fs::path(m_context.config.path.spool) / config.app;
-         
-    m_sandbox = m_context.get<api::sandbox_t>(
-      m_manifest->sandbox.type,
-      m_context,
-      m_manifest->name,
-      m_manifest->sandbox.args,
-      path.string()
-      );
+    const std::string path = (fs::path(m_context.config.path.spool) / config.app).string();
+
+    shard_t::factory_t factory(config.sandbox);
+
+    if(config.preload && config.preload->sandbox) {
+      std::shared_ptr<preload_t> preload(config.preload);
+
+      factory = [preload]() {
+        return std::move(preload->sandbox);
+      };
+    } else if(!factory) {
+      factory = [this, path]() {
+        return m_context.get<api::sandbox_t>(
+          m_manifest->sandbox.type,
+          m_context,
+          m_manifest->name,
+          m_manifest->sandbox.args,
+          path
+          );
+      };
+    }
+
+    if(m_settings->shm_threshold) {
+      m_side.reset(new side_channel_t(
+        cocaine::format("/cocaine.%s", m_id),
+        m_settings->shm_size
+        ));
+    }
+
+    if(m_settings->threads == 1) {
+      m_executor.reset(new executor_t(
+        *m_reactor,
+        *this,
+        factory(),
+        *m_settings,
+        m_metrics,
+        1,
+        std::bind(&worker_t::on_resume, this),
+        m_side.get()
+        ));
+    } else {
+      // NOTE: Each shard creates its own sandbox instance on its own thread.
+      m_notifier.reset(new async_watcher_t(*m_reactor, std::bind(&worker_t::on_notify, this)));
+      m_dispatcher.reset(new dispatcher_t(
+        m_settings->threads,
+        m_settings->worker_inflight_high,
+        m_settings->worker_inflight_low
+        ));
+      m_affinity.reserve(m_settings->session_capacity);
+
+      for(size_t i = 0; i < m_settings->threads; ++i) {
+        async_watcher_t * notifier = m_notifier.get();
+
+        m_shards.emplace_back(new shard_t(
+          *m_settings,
+          m_metrics,
+          *m_dispatcher,
+          i,
+          m_settings->threads,
+          factory,
+          [notifier]() { notifier->send(); },
+          m_side.get()
+          ));
+      }
+    }
+
+    m_startup.mark("sandbox");
   } catch(const std::exception& e) {
     terminate(rpc::suicide::abnormal, e.what());
     throw;
@@ -153,58 +153,341 @@ worker_t::worker_t(context_t& context,
     terminate(rpc::suicide::abnormal, "unexpected exception");
     throw;
   }
+
+  m_outbox.reset(new outbox_t(
+    m_channel,
+    m_settings->outbound_queue_high,
+    m_settings->outbound_queue_low,
+    std::bind(&worker_t::on_drain, this)
+    ));
+
+  m_tracer.reset(new tracer_t(
+    m_log.get(),
+    cocaine::format("worker %s", m_id),
+    m_settings->trace,
+    m_settings->trace_ring_size
+    ));
+
+  m_budget.reset(new io_budget_t(
+    m_settings->io_bulk_size,
+    m_settings->io_bulk_min,
+    m_settings->io_bulk_max,
+    m_settings->io_bulk_time
+    ));
+
+  m_stats.io_bulk_size = m_budget->limit();
+
+  m_watcher.reset(new io_watcher_t(
+    *m_reactor,
+    std::bind(&worker_t::on_event, this),
+    std::bind(&worker_t::on_channel_error, this, std::placeholders::_1)
+    ));
+  m_watcher->start(m_channel.fd());
+  m_checker.reset(new idle_watcher_t(*m_reactor, std::bind(&worker_t::on_event, this)));
+
+  rearm();
+
+  m_monitor.reset(new loop_monitor_t(*m_reactor, &m_metrics.iteration_time));
+
+  m_heartbeat_timer.reset(new timer_watcher_t(*m_reactor, std::bind(&worker_t::on_heartbeat, this)));
+  m_heartbeat_timer->start(0.0f, m_settings->heartbeat_interval);
     
-  m_disown_timer.set<worker_t, &worker_t::on_disown>(this);
-  m_disown_timer.start(m_profile->heartbeat_timeout);
+  m_disown_timer.reset(new timer_watcher_t(*m_reactor, std::bind(&worker_t::on_disown, this)));
+  m_disown_timer->start(m_profile->heartbeat_timeout);
+
+  m_dump_signal.reset(new signal_watcher_t(*m_reactor, std::bind(&worker_t::on_dump, this)));
+  m_dump_signal->start(SIGUSR2);
+
+  m_metrics_timer.reset(new timer_watcher_t(*m_reactor, std::bind(&worker_t::on_tick, this)));
+  m_metrics_timer->start(1.0f, 1.0f);
+
+  m_retire_timer.reset(new timer_watcher_t(*m_reactor, std::bind(&worker_t::on_retire_timeout, this)));
+  m_offer_timer.reset(new timer_watcher_t(*m_reactor, std::bind(&worker_t::on_offer_timeout, this)));
+  m_retirer.reset(new prepare_watcher_t(*m_reactor, std::bind(&worker_t::on_retire, this)));
+
+  if(m_settings->metrics) {
+    const std::string path = cocaine::format(
+      "%s/%s.%s.metrics",
+      m_context.config.path.runtime,
+      config.app,
+      config.uuid);
+
+    m_metrics_socket.reset(new metrics_socket_t(
+      *m_reactor,
+      path,
+      std::bind(&worker_t::snapshot, this)
+      ));
+  }
+
+  m_startup.mark("setup");
 }
 
 worker_t::~worker_t() {
-  // Empty.
+  COCAINE_LOG_INFO(
+    m_log,
+    "worker %s has been woken up %llu times, %llu of them in vain",
+    m_id,
+    m_stats.wakeups,
+    m_stats.wasted_wakeups
+    );
 }
 
 void
 worker_t::run() {
-  m_loop.loop();
+  ready();
+
+  m_reactor->run();
+}
+
+std::string
+worker_t::snapshot() const {
+  Json::Value result(m_metrics.snapshot());
+
+  const worker_stats_t current(stats());
+
+  result["sessions"] = static_cast<Json::UInt64>(sessions());
+  result["threads"] = static_cast<Json::UInt64>(m_settings->threads);
+  result["wakeups"] = static_cast<Json::UInt64>(current.wakeups);
+  result["wasted-wakeups"] = static_cast<Json::UInt64>(current.wasted_wakeups);
+  result["io-bulk-size"] = static_cast<Json::UInt64>(current.io_bulk_size);
+  result["pool-hits"] = static_cast<Json::UInt64>(current.pool_hits);
+  result["pool-misses"] = static_cast<Json::UInt64>(current.pool_misses);
+  result["inflight-bytes"] = static_cast<Json::UInt64>(current.inflight_bytes);
+  result["throttles"] = static_cast<Json::UInt64>(current.throttles);
+  result["outbound-bytes"] = static_cast<Json::UInt64>(m_outbox->bytes());
+  result["send-stalls"] = static_cast<Json::UInt64>(current.send_stalls);
+  result["loop-lag"] = current.loop_lag;
+  result["loop-busy"] = current.loop_busy;
+  result["rss"] = static_cast<Json::UInt64>(current.rss);
+  result["startup"] = m_startup.snapshot();
+
+  return Json::FastWriter().write(result);
+}
+
+worker_stats_t
+worker_t::stats() const {
+  worker_stats_t stats(m_stats);
+
+  stats.pool_hits = 0;
+  stats.pool_misses = 0;
+  stats.inflight_bytes = 0;
+
+  if(m_executor) {
+    stats.pool_hits = m_executor->pool().hits();
+    stats.pool_misses = m_executor->pool().misses();
+    stats.inflight_bytes = m_executor->inflight();
+  }
+
+  for(auto it = m_shards.begin(); it != m_shards.end(); ++it) {
+    stats.pool_hits += (*it)->pool_hits();
+    stats.pool_misses += (*it)->pool_misses();
+    stats.inflight_bytes += (*it)->inflight();
+  }
+
+  if(m_dispatcher) {
+    stats.inflight_bytes += m_dispatcher->buffered();
+  }
+
+  stats.send_stalls = m_outbox->stalls();
+
+  return stats;
+}
+
+void
+worker_t::send(zmq::message_t * frames,
+               size_t count)
+{
+  for(size_t i = 0; i < count; ++i) {
+    m_outbox->append(frames[i], i + 1 < count);
+  }
+
+  // Sending might have swallowed the edge of an incoming message.
+  if(m_readiness == readiness_t::waiting || m_readiness == readiness_t::throttled) {
+    rearm();
+  }
+}
+
+bool
+worker_t::writable() const {
+  return !m_outbox->congested();
 }
 
 void
-worker_t::on_event(ev::io&, int) {
-  m_checker.stop();
+worker_t::ready() {
+  // NOTE: The offer goes first, so that an engine which supports it maps
+  // the segment before the first invoke.
+  if(m_side) {
+    send<shm::offer>(m_side->name(), static_cast<uint64_t>(m_side->size()));
+
+    // NOTE: An engine which hasn't answered within the heartbeat timeout
+    // isn't going to, so the segment isn't left linked for any longer.
+    m_offer_timer->start(m_profile->heartbeat_timeout);
+  }
+
+  // NOTE: The sandbox has been loaded by now, and the engine doesn't send
+  // invokes before the first heartbeat, which goes out on the first loop
+  // iteration.
+  m_startup.mark("ready");
+
+  COCAINE_LOG_INFO(
+    m_log,
+    "worker %s is ready in %.3fms: %s",
+    m_id,
+    m_startup.total(),
+    m_startup.format()
+    );
+}
 
-  if(m_channel.pending()) {
-    m_checker.start();
+void
+worker_t::on_event() {
+  bool wasted = true;
+
+  ++m_stats.wakeups;
+
+  if(!m_outbox->empty() && m_channel.pending(ZMQ_POLLOUT)) {
+    m_readiness = readiness_t::processing;
+    m_outbox->flush();
+
+    wasted = false;
+  }
+
+  if(!congested() && m_channel.pending()) {
+    m_readiness = readiness_t::processing;
     process();
+
+    wasted = false;
+  }
+
+  if(wasted) {
+    ++m_stats.wasted_wakeups;
   }
+
+  rearm();
 }
 
 void
-worker_t::on_check(ev::prepare&, int) {
-  m_loop.feed_fd_event(m_channel.fd(), ev::READ);
+worker_t::rearm() {
+  const bool readable = !congested() && m_channel.pending(),
+             writable = !m_outbox->empty() && m_channel.pending(ZMQ_POLLOUT);
+
+  if(readable || writable) {
+    m_readiness = readiness_t::draining;
+    m_checker->start();
+  } else {
+    m_readiness = congested() ? readiness_t::throttled : readiness_t::waiting;
+    m_checker->stop();
+  }
 }
 
 void
-worker_t::on_heartbeat(ev::timer&, int) {
-  scoped_option<
-    options::send_timeout
-    > option(m_channel, 0);
-    
-  send<rpc::heartbeat>();
+worker_t::on_resume() {
+  // NOTE: Inside process() the state is re-evaluated anyway.
+  if(m_readiness == readiness_t::throttled) {
+    rearm();
+  }
+}
+
+void
+worker_t::on_notify() {
+  exchange();
+
+  // NOTE: Inside process() the state is re-evaluated anyway.
+  if(m_readiness == readiness_t::waiting || m_readiness == readiness_t::throttled) {
+    rearm();
+  }
+}
+
+void
+worker_t::on_drain() {
+  if(m_executor) {
+    m_executor->drained();
+  } else {
+    // NOTE: This is called from within the outbox, so the shards are left
+    // for the next loop iteration.
+    m_notifier->send();
+  }
+}
+
+void
+worker_t::on_heartbeat() {
+  const loop_monitor_t::sample_t sample(m_monitor->sample());
+
+  m_stats.loop_lag = sample.lag;
+  m_stats.loop_busy = sample.busy;
+  m_stats.rss = resident_size();
+
+  if(m_settings->heartbeat_load) {
+    const load_t load = {
+      sample.lag,
+      sample.busy,
+      sessions(),
+      m_outbox->bytes(),
+      m_metrics.invoke_rate.rate(),
+      m_stats.rss
+    };
+
+    send<rpc::heartbeat>(load);
+  } else {
+    send<rpc::heartbeat>();
+  }
 }
 
 void
-worker_t::on_disown(ev::timer&, int) {
+worker_t::on_tick() {
+  m_metrics.tick(m_reactor->now());
+}
+
+void
+worker_t::on_dump() {
+  m_tracer->dump();
+}
+
+void
+worker_t::on_channel_error(const std::string& reason) {
+  COCAINE_LOG_ERROR(
+    m_log,
+    "worker %s is unable to poll the engine channel - %s",
+    m_id,
+    reason
+    );
+
+  terminate(rpc::suicide::abnormal, cocaine::format("unable to poll the channel - %s", reason));
+}
+
+void
+worker_t::on_disown() {
   COCAINE_LOG_ERROR(
     m_log,
     "worker %s has lost the controlling engine",
     m_id
     );
 
-  m_loop.unloop(ev::ALL);    
+  m_reactor->stop();
+}
+
+void
+worker_t::on_offer_timeout() {
+  if(m_side->accepted()) {
+    return;
+  }
+
+  // NOTE: An engine which has mapped the segment in the meantime may still
+  // accept it later on.
+  m_side->unlink();
+
+  COCAINE_LOG_WARNING(
+    m_log,
+    "worker %s got no answer to the shared memory offer, sending every chunk over the channel",
+    m_id
+    );
 }
 
 void
 worker_t::process() {
-  int counter = defaults::io_bulk_size;
+  bool drained = false,
+       throttled = false;
+
+  m_budget->start();
 
   do {
     // TEST: Ensure that we haven't missed something in a previous iteration.
@@ -218,123 +501,388 @@ worker_t::process() {
           > option(m_channel, 0);
 
         if(!m_channel.recv(message_id)) {
-          return;
+          drained = true;
+          break;
         }
       }
 
-      COCAINE_LOG_DEBUG(
-        m_log,
-        "worker %s received type %d message",
-        m_id,
+      COCAINE_WORKER_TRACE(
+        *m_tracer,
+        logging::debug,
+        trace_event_t::received,
         message_id);
 
-      switch(message_id) {
-        case event_traits<rpc::heartbeat>::id:
-          m_disown_timer.stop();
-          m_disown_timer.start(m_profile->heartbeat_timeout);
+      if(!m_protocol.dispatch(message_id, m_channel)) {
+        COCAINE_LOG_WARNING(
+          m_log,
+          "worker %s dropping unknown or malformed type %d message", 
+          m_id,
+          message_id
+          );
                 
-          break;
+        m_channel.drop();
+      }
 
-        case event_traits<rpc::invoke>::id: {
-          unique_id_t session_id(uninitialized);
-          std::string event;
+      if(congested()) {
+        ++m_stats.throttles;
 
-          m_channel.recv<rpc::invoke>(session_id, event);
+        throttled = true;
+        break;
+      }
+  } while(m_budget->consume());
 
-          boost::shared_ptr<api::stream_t> upstream(
-            boost::make_shared<upstream_t>(session_id, this)
-            );
+  // NOTE: A throttled drain tells nothing about the budget, so it doesn't
+  // get to grow the limit.
+  m_budget->finish(drained || throttled);
+  m_stats.io_bulk_size = m_budget->limit();
 
-          try {
-            io_pair_t io = {
-              upstream,
-              m_sandbox->invoke(event, upstream)
-            };
+  exchange();
+}
 
-            m_streams.emplace(session_id, io);
-          } catch(const std::exception& e) {
-            upstream->error(invocation_error, e.what());
-          } catch(...) {
-            upstream->error(invocation_error, "unexpected exception");
-          }
+void
+worker_t::handle(event_tag<rpc::heartbeat>) {
+  m_disown_timer->start(m_profile->heartbeat_timeout);
+}
 
-          break;
-        }
+void
+worker_t::handle(event_tag<rpc::invoke>,
+                 const unique_id_t& session_id,
+                 const std::string& event)
+{
+  if(m_retiring) {
+    send<rpc::error>(
+      session_id,
+      static_cast<int>(resource_error),
+      std::string("the worker is shutting down")
+      );
 
-        case event_traits<rpc::chunk>::id: {
-          unique_id_t session_id(uninitialized);
-          std::string message;
+    send<rpc::choke>(session_id);
 
-          m_channel.recv<rpc::chunk>(session_id, message);
+    return;
+  }
 
-          stream_map_t::iterator it(m_streams.find(session_id));
+  // NOTE: Only the sessions the worker has taken count, so that the rate
+  // published with the heartbeats isn't inflated while draining.
+  m_metrics.invokes.fetch_add(1, std::memory_order_relaxed);
 
-          // NOTE: This may be a chunk for a failed invocation, in which case there
-          // will be no active stream, so drop the message.
-          if(it != m_streams.end()) {
-            try {
-              it->second.downstream->push(message.data(), message.size());
-            } catch(const std::exception& e) {
-              it->second.upstream->error(invocation_error, e.what());
-              m_streams.erase(it);
-            } catch(...) {
-              it->second.upstream->error(invocation_error, "unexpected exception");
-              m_streams.erase(it);
-            }
-          }
+  if(m_executor) {
+    m_executor->invoke(session_id, event);
+    return;
+  }
 
-          break;
-        }
+  boost::shared_ptr<pending_t> session(
+    boost::make_shared<pending_t>(session_id, event)
+    );
 
-        case event_traits<rpc::choke>::id: {
-          unique_id_t session_id(uninitialized);
+  m_shards[least_loaded()]->invoke(session);
+  m_affinity.emplace(session_id, session);
+}
 
-          m_channel.recv<rpc::choke>(session_id);
+void
+worker_t::handle(event_tag<rpc::chunk>,
+                 const unique_id_t& session_id,
+                 zmq::message_t& frame)
+{
+  // NOTE: The payload frame is received as is and handed over to the
+  // executor, which decodes the chunk right in place.
+  if(m_executor) {
+    m_executor->chunk(session_id, frame);
+    return;
+  }
 
-          stream_map_t::iterator it = m_streams.find(session_id);
+  affinity_map_t::iterator it(m_affinity.find(session_id));
 
-          // NOTE: This may be a choke for a failed invocation, in which case there
-          // will be no active stream, so drop the message.
-          if(it != m_streams.end()) {
-            try {
-              it->second.downstream->close();
-            } catch(const std::exception& e) {
-              it->second.upstream->error(invocation_error, e.what());
-            } catch(...) {
-              it->second.upstream->error(invocation_error, "unexpected exception");
-            }
-                    
-            m_streams.erase(it);
-          }
+  // NOTE: The session might have been choked already, in which case the
+  // chunk is dropped just like for a failed invocation.
+  if(it != m_affinity.end() && !m_dispatcher->chunk(*it->second, frame)) {
+    m_shards[it->second->owner.load(std::memory_order_acquire)]->chunk(session_id, frame);
+  }
+}
 
-          break;
-        }
-            
-        case event_traits<rpc::terminate>::id:
-          terminate(rpc::suicide::normal, "per request");
-          break;
+void
+worker_t::handle(event_tag<rpc::choke>,
+                 const unique_id_t& session_id)
+{
+  if(m_executor) {
+    m_executor->choke(session_id);
+    return;
+  }
 
-        default:
-          COCAINE_LOG_WARNING(
-            m_log,
-            "worker %s dropping unknown type %d message", 
-            m_id,
-            message_id
-            );
-                
-          m_channel.drop();
+  affinity_map_t::iterator it(m_affinity.find(session_id));
+
+  if(it != m_affinity.end()) {
+    if(!m_dispatcher->choke(*it->second)) {
+      m_shards[it->second->owner.load(std::memory_order_acquire)]->choke(session_id);
+    }
+
+    m_affinity.erase(it);
+  }
+}
+
+void
+worker_t::handle(event_tag<rpc::terminate>) {
+  retire();
+}
+
+void
+worker_t::handle(event_tag<shm::accept>) {
+  if(!m_side || m_side->accepted()) {
+    return;
+  }
+
+  m_side->accept();
+  m_offer_timer->stop();
+
+  COCAINE_LOG_INFO(
+    m_log,
+    "worker %s sends the chunks of %llu bytes and more through shared memory",
+    m_id,
+    m_settings->shm_threshold
+    );
+}
+
+void
+worker_t::handle(event_tag<shm::chunk>,
+                 const unique_id_t& session_id,
+                 uint64_t offset,
+                 uint64_t size)
+{
+  zmq::message_t frame;
+
+  if(!m_side || !m_side->read(offset, size, frame)) {
+    COCAINE_LOG_WARNING(
+      m_log,
+      "worker %s dropping a chunk with a bogus shared memory descriptor",
+      m_id
+      );
+
+    return;
+  }
+
+  handle(event_tag<rpc::chunk>(), session_id, frame);
+}
+
+void
+worker_t::retire() {
+  if(m_retiring) {
+    return;
+  }
+
+  m_retiring = true;
+
+  // NOTE: The shards' counts might be stale, so they are always asked.
+  if(m_settings->drain_timeout == 0.0 || (m_executor && m_executor->open() == 0)) {
+    terminate(rpc::suicide::normal, "per request");
+    return;
+  }
+
+  COCAINE_LOG_INFO(
+    m_log,
+    "worker %s is draining %llu sessions before terminating",
+    m_id,
+    open()
+    );
+
+  for(auto it = m_shards.begin(); it != m_shards.end(); ++it) {
+    (*it)->retire();
+  }
+
+  m_retire_timer->start(m_settings->drain_timeout);
+  m_retirer->start();
+}
+
+void
+worker_t::on_retire() {
+  if(m_executor && m_executor->open() != 0) {
+    return;
+  }
+
+  for(auto it = m_shards.begin(); it != m_shards.end(); ++it) {
+    if(!(*it)->retired()) {
+      return;
+    }
+  }
+
+  m_retirer->stop();
+  m_retire_timer->stop();
+
+  terminate(rpc::suicide::normal, "per request");
+}
+
+void
+worker_t::on_retire_timeout() {
+  if(m_aborting) {
+    const size_t dropped = open();
+
+    COCAINE_LOG_WARNING(
+      m_log,
+      "worker %s is dropping %llu sessions the sandbox threads have failed to close",
+      m_id,
+      dropped
+      );
+
+    m_retirer->stop();
+
+    terminate(
+      rpc::suicide::normal,
+      cocaine::format("per request, %llu sessions dropped on the drain timeout", dropped)
+      );
+
+    return;
+  }
+
+  m_aborting = true;
+
+  COCAINE_LOG_WARNING(
+    m_log,
+    "worker %s is failing %llu sessions on the drain timeout",
+    m_id,
+    open()
+    );
+
+  if(m_executor) {
+    m_executor->abort(resource_error, "the worker is shutting down");
+  }
+
+  if(m_dispatcher) {
+    const std::vector<boost::shared_ptr<pending_t>> queued(m_dispatcher->cancel());
+
+    for(auto it = queued.begin(); it != queued.end(); ++it) {
+      send<rpc::error>(
+        (*it)->session_id,
+        static_cast<int>(resource_error),
+        std::string("the worker is shutting down")
+        );
+
+      send<rpc::choke>((*it)->session_id);
+
+      affinity_map_t::iterator session(m_affinity.find((*it)->session_id));
+
+      if(session != m_affinity.end()) {
+        m_affinity.erase(session);
       }
-  } while(--counter);
+    }
+  }
+
+  for(auto it = m_shards.begin(); it != m_shards.end(); ++it) {
+    (*it)->abort();
+  }
 
-  // Feed the event loop.
-  m_loop.feed_fd_event(m_channel.fd(), ev::READ);
+  // NOTE: The sessions are failed on the shard threads, and the worker goes
+  // away as soon as they are done, see on_retire(), unless some thread is
+  // stuck in the sandbox for longer.
+  m_retire_timer->start(abort_timeout);
+}
+
+size_t
+worker_t::open() const {
+  size_t result = m_executor ? m_executor->open() : 0;
+
+  for(auto it = m_shards.begin(); it != m_shards.end(); ++it) {
+    result += (*it)->open();
+  }
 
+  return result;
+}
+
+void
+worker_t::exchange() {
+  bool behind = false;
+
+  for(size_t i = 0; i < m_shards.size(); ++i) {
+    m_shards[i]->commit();
+    m_shards[i]->collect(*m_outbox, m_expired);
+
+    behind = behind || m_dispatcher->depth(i) > 1;
+  }
+
+  for(auto it = m_expired.begin(); it != m_expired.end(); ++it) {
+    affinity_map_t::iterator session(m_affinity.find(*it));
+
+    if(session != m_affinity.end()) {
+      m_affinity.erase(session);
+    }
+  }
+
+  m_expired.clear();
+
+  if(!behind) {
+    return;
+  }
+
+  for(size_t i = 0; i < m_shards.size(); ++i) {
+    if(m_dispatcher->depth(i) == 0) {
+      m_shards[i]->poke();
+    }
+  }
+}
+
+bool
+worker_t::congested() const {
+  if(m_executor) {
+    return m_executor->congested();
+  }
+
+  if(m_dispatcher->congested()) {
+    return true;
+  }
+
+  for(auto it = m_shards.begin(); it != m_shards.end(); ++it) {
+    if((*it)->congested()) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+size_t
+worker_t::sessions() const {
+  size_t result = m_executor ? m_executor->sessions() : 0;
+
+  for(auto it = m_shards.begin(); it != m_shards.end(); ++it) {
+    result += (*it)->sessions();
+  }
+
+  return result;
+}
+
+size_t
+worker_t::least_loaded() {
+  size_t result = m_next,
+         minimum = std::numeric_limits<size_t>::max();
+
+  // NOTE: The scan starts past the previous pick, so that the ties are
+  // broken in a round-robin fashion.
+  for(size_t i = 0; i < m_shards.size(); ++i) {
+    const size_t index = (m_next + i) % m_shards.size(),
+                 load = m_shards[index]->sessions() + m_dispatcher->depth(index);
+
+    if(load < minimum) {
+      result = index;
+      minimum = load;
+    }
+  }
+
+  m_next = (result + 1) % m_shards.size();
+
+  return result;
 }
 
 void
 worker_t::terminate(rpc::suicide::reasons reason,
                     const std::string& message)
 {
-  send<rpc::suicide>(static_cast<int>(reason), message);
-  m_loop.unloop(ev::ALL);
+  // NOTE: The worker might be failing before the queue is set up, and once
+  // it's going away anyway, blocking on the queue is fine.
+  if(m_outbox) {
+    send<rpc::suicide>(static_cast<int>(reason), message);
+    m_outbox->drain();
+  } else {
+    m_channel.send<rpc::suicide>(static_cast<int>(reason), message);
+  }
+
+  if(m_reactor) {
+    m_reactor->stop();
+  }
 }
@@ -0,0 +1,608 @@
+#include "zygote.hpp"
+
+#include <cocaine/context.hpp>
+#include <cocaine/logging.hpp>
+#include <cocaine/manifest.hpp>
+#include <cocaine/profile.hpp>
+
+#include <cocaine/api/sandbox.hpp>
+
+#include <boost/filesystem/path.hpp>
+
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace cocaine;
+using namespace cocaine::engine;
+using namespace cocaine::logging;
+
+namespace fs = boost::filesystem;
+
+namespace {
+  bool
+  make_address(const std::string& path,
+               sockaddr_un& address)
+  {
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if(path.size() >= sizeof(address.sun_path)) {
+      return false;
+    }
+
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    return true;
+  }
+
+  // NOTE: The lines are a few bytes long, so they are read byte by byte.
+  bool
+  read_line(int fd,
+            std::string& line)
+  {
+    char byte = 0;
+
+    line.clear();
+
+    while(true) {
+      const ssize_t result = ::read(fd, &byte, 1);
+
+      if(result < 0 && errno == EINTR) {
+        continue;
+      }
+
+      if(result <= 0) {
+        return false;
+      }
+
+      if(byte == '\n') {
+        return true;
+      }
+
+      line.push_back(byte);
+    }
+  }
+
+  bool
+  read_number(int fd,
+              int& value)
+  {
+    std::string line;
+
+    if(!read_line(fd, line) || line.empty()) {
+      return false;
+    }
+
+    char * end = nullptr;
+
+    value = std::strtol(line.c_str(), &end, 10);
+
+    return *end == '\0';
+  }
+
+  bool
+  write_line(int fd,
+             const std::string& line)
+  {
+    const std::string data(line + "\n");
+
+    return ::send(fd, data.data(), data.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(data.size());
+  }
+
+  // The number of threads in this process.
+  size_t
+  threads() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+
+    while(std::getline(status, line)) {
+      if(line.compare(0, 8, "Threads:") == 0) {
+        return std::strtoul(line.c_str() + 8, nullptr, 10);
+      }
+    }
+
+    return 0;
+  }
+
+  // The requests are sent right after connecting, so a client which is that
+  // slow is broken anyway.
+  const std::chrono::seconds request_timeout(1);
+
+  // A uuid is 36 characters long, so anything much longer is garbage.
+  const size_t request_limit = 64;
+
+  volatile pid_t relay_target = 0;
+
+  void
+  relay(int signum) {
+    if(relay_target > 0) {
+      ::kill(relay_target, signum);
+    }
+  }
+}
+
+zygote_t::zygote_t(context_t& context,
+                   const std::string& app,
+                   const std::string& profile,
+                   bool preload):
+  m_context(context),
+  m_log(new log_t(context, cocaine::format("app/%s", app))),
+  m_app(app),
+  m_profile(profile),
+  m_path(endpoint(context.config.path.runtime, app, profile)),
+  m_preload(std::make_shared<preload_t>()),
+  m_threads(0),
+  m_listener(-1),
+  m_signals(-1),
+  m_forked(false)
+{
+  m_preload->manifest.reset(new manifest_t(m_context, m_app));
+  m_preload->profile.reset(new profile_t(m_context, m_profile));
+  m_preload->settings.reset(new settings_t(*m_preload->profile));
+
+  if(!m_preload->settings->zygote) {
+    throw configuration_error_t("the zygote isn't enabled in the profile");
+  }
+
+#ifndef COCAINE_WORKER_HAVE_LOOP_FORK
+  if(m_preload->settings->backend == reactor_t::backend_t::libuv) {
+    throw configuration_error_t("the zygote needs libuv 1.12 or newer for the libuv event loop");
+  }
+#endif
+  m_preload->reactor.reset(new reactor_t(m_preload->settings->backend));
+
+  // NOTE: The sandbox threads can't be carried over by a fork, so in the
+  // multi-threaded mode every worker still loads the sandboxes on its own.
+  if(preload && m_preload->settings->zygote_preload && m_preload->settings->threads == 1) {
+    const manifest_t& manifest = *m_preload->manifest;
+
+    m_threads = threads();
+
+    m_preload->sandbox = m_context.get<api::sandbox_t>(
+      manifest.sandbox.type,
+      m_context,
+      manifest.name,
+      manifest.sandbox.args,
+      (fs::path(m_context.config.path.spool) / m_app).string()
+      );
+
+    const size_t started = threads();
+
+    if(started > m_threads) {
+      throw preload_error_t(started - m_threads);
+    }
+
+    COCAINE_LOG_INFO(m_log, "zygote has preloaded the sandbox");
+  }
+
+  sockaddr_un address;
+
+  if(!make_address(m_path, address)) {
+    throw cocaine::error_t("the zygote socket path '%s' is too long", m_path);
+  }
+
+  sigset_t signals;
+
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGCHLD);
+
+  ::sigprocmask(SIG_BLOCK, &signals, nullptr);
+
+  m_signals = ::signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  m_listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+  if(m_signals < 0 || m_listener < 0) {
+    throw cocaine::error_t("unable to create the zygote socket - %s", std::strerror(errno));
+  }
+
+  // NOTE: A stale socket might be left behind by a crashed zygote.
+  ::unlink(m_path.c_str());
+
+  // NOTE: Whoever can connect can have a worker forked, so the socket is
+  // created accessible to the owner only.
+  const mode_t mask = ::umask(S_IRWXG | S_IRWXO);
+  const int bound = ::bind(m_listener, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+
+  ::umask(mask);
+
+  if(bound != 0 || ::listen(m_listener, 128) != 0) {
+    throw cocaine::error_t(
+      "unable to bind the zygote socket to '%s' - %s",
+      m_path,
+      std::strerror(errno)
+    );
+  }
+
+  COCAINE_LOG_INFO(m_log, "zygote is ready for the workers on '%s'", m_path);
+}
+
+zygote_t::~zygote_t() {
+  if(m_forked) {
+    return;
+  }
+
+  for(auto it = m_requests.begin(); it != m_requests.end(); ++it) {
+    ::close(it->first);
+  }
+
+  for(auto it = m_children.begin(); it != m_children.end(); ++it) {
+    ::close(it->second);
+  }
+
+  if(m_listener >= 0) {
+    ::close(m_listener);
+    ::unlink(m_path.c_str());
+  }
+
+  if(m_signals >= 0) {
+    ::close(m_signals);
+  }
+}
+
+worker_config_t
+zygote_t::run() {
+  worker_config_t config;
+
+  std::vector<pollfd> fds;
+  std::vector<pid_t> pids;
+  std::vector<int> clients;
+
+  while(true) {
+    fds.clear();
+    pids.clear();
+    clients.clear();
+
+    pollfd listener = { m_listener, POLLIN, 0 },
+           signals = { m_signals, POLLIN, 0 };
+
+    fds.push_back(listener);
+    fds.push_back(signals);
+
+    for(auto it = m_children.begin(); it != m_children.end(); ++it) {
+      pollfd client = { it->second, POLLIN, 0 };
+
+      fds.push_back(client);
+      pids.push_back(it->first);
+    }
+
+    for(auto it = m_requests.begin(); it != m_requests.end(); ++it) {
+      pollfd client = { it->first, POLLIN, 0 };
+
+      fds.push_back(client);
+      clients.push_back(it->first);
+    }
+
+    if(::poll(fds.data(), fds.size(), timeout()) < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+
+      throw cocaine::error_t("unable to wait for the zygote requests - %s", std::strerror(errno));
+    }
+
+    if(fds[1].revents) {
+      on_child();
+    }
+
+    // NOTE: The clients never send anything after the request, so this is
+    // either a hangup or garbage.
+    for(size_t i = 0; i < pids.size(); ++i) {
+      if(fds[i + 2].revents) {
+        on_hangup(pids[i]);
+      }
+    }
+
+    for(size_t i = 0; i < clients.size(); ++i) {
+      if(fds[i + 2 + pids.size()].revents && on_read(clients[i], config)) {
+        return config;
+      }
+    }
+
+    on_expire();
+
+    if(fds[0].revents) {
+      on_accept();
+    }
+  }
+}
+
+std::string
+zygote_t::endpoint(const std::string& runtime,
+                   const std::string& app,
+                   const std::string& profile)
+{
+  return cocaine::format("%s/%s.%s.zygote", runtime, app, profile);
+}
+
+int
+zygote_t::timeout() const {
+  if(m_requests.empty()) {
+    return -1;
+  }
+
+  std::chrono::steady_clock::time_point deadline = m_requests.begin()->second.deadline;
+
+  for(auto it = m_requests.begin(); it != m_requests.end(); ++it) {
+    deadline = std::min(deadline, it->second.deadline);
+  }
+
+  const std::chrono::steady_clock::duration left = deadline - std::chrono::steady_clock::now();
+
+  // NOTE: Rounded up, so that the deadline has passed once poll() is done.
+  return std::max<int>(0, std::chrono::duration_cast<std::chrono::milliseconds>(left).count() + 1);
+}
+
+void
+zygote_t::on_accept() {
+  int client = -1;
+
+  while((client = ::accept4(m_listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    ucred credentials;
+    socklen_t length = sizeof(credentials);
+
+    if(::getsockopt(client, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0 ||
+       credentials.uid != ::geteuid())
+    {
+      COCAINE_LOG_WARNING(m_log, "zygote is rejecting a client of a foreign user");
+
+      ::close(client);
+      continue;
+    }
+
+    request_t& request = m_requests[client];
+
+    request.deadline = std::chrono::steady_clock::now() + request_timeout;
+  }
+}
+
+void
+zygote_t::on_expire() {
+  const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+  for(auto it = m_requests.begin(); it != m_requests.end();) {
+    if(it->second.deadline > now) {
+      ++it;
+      continue;
+    }
+
+    COCAINE_LOG_WARNING(m_log, "zygote is dropping a client which hasn't sent its request in time");
+
+    ::close(it->first);
+    it = m_requests.erase(it);
+  }
+}
+
+bool
+zygote_t::on_read(int client,
+                  worker_config_t& config)
+{
+  auto it = m_requests.find(client);
+
+  if(it == m_requests.end()) {
+    return false;
+  }
+
+  char buffer[request_limit];
+
+  const ssize_t result = ::recv(client, buffer, sizeof(buffer), 0);
+
+  if(result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+    return false;
+  }
+
+  std::string& line = it->second.line;
+
+  if(result > 0) {
+    line.append(buffer, result);
+  }
+
+  const size_t end = line.find('\n');
+
+  if(end == std::string::npos) {
+    if(result <= 0 || line.size() > request_limit) {
+      ::close(client);
+      m_requests.erase(it);
+    }
+
+    return false;
+  }
+
+  const std::string uuid(line, 0, end);
+
+  m_requests.erase(it);
+
+  if(uuid.empty()) {
+    ::close(client);
+    return false;
+  }
+
+  return on_request(client, uuid, config);
+}
+
+bool
+zygote_t::on_request(int client,
+                     const std::string& uuid,
+                     worker_config_t& config)
+{
+  // NOTE: The sandbox might start its threads later on, and then the client
+  // has to load the app on its own.
+  if(m_preload->sandbox && threads() > m_threads) {
+    COCAINE_LOG_ERROR(
+      m_log,
+      "zygote is unable to fork worker %s - the sandbox has started threads",
+      uuid
+    );
+
+    ::close(client);
+    return false;
+  }
+
+  timeline_t startup;
+
+  const pid_t pid = ::fork();
+
+  if(pid < 0) {
+    COCAINE_LOG_ERROR(m_log, "unable to fork worker %s - %s", uuid, std::strerror(errno));
+
+    ::close(client);
+    return false;
+  }
+
+  if(pid == 0) {
+    m_forked = true;
+
+    ::close(client);
+    ::close(m_listener);
+    ::close(m_signals);
+
+    for(auto it = m_requests.begin(); it != m_requests.end(); ++it) {
+      ::close(it->first);
+    }
+
+    for(auto it = m_children.begin(); it != m_children.end(); ++it) {
+      ::close(it->second);
+    }
+
+    sigset_t signals;
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGCHLD);
+
+    ::sigprocmask(SIG_UNBLOCK, &signals, nullptr);
+
+    m_preload->reactor->fork();
+
+    startup.mark("fork");
+
+    config.app = m_app;
+    config.profile = m_profile;
+    config.uuid = uuid;
+    config.preload = m_preload;
+    config.startup = startup;
+
+    return true;
+  }
+
+  COCAINE_LOG_INFO(m_log, "zygote has forked worker %s with pid %d", uuid, pid);
+
+  if(!write_line(client, std::to_string(pid))) {
+    // NOTE: Nobody is going to look after the worker.
+    ::kill(pid, SIGKILL);
+    ::close(client);
+
+    return false;
+  }
+
+  m_children[pid] = client;
+
+  return false;
+}
+
+void
+zygote_t::on_child() {
+  signalfd_siginfo info;
+
+  while(::read(m_signals, &info, sizeof(info)) == sizeof(info)) {
+    // Empty.
+  }
+
+  int status = 0;
+  pid_t pid = 0;
+
+  while((pid = ::waitpid(-1, &status, WNOHANG)) > 0) {
+    auto it = m_children.find(pid);
+
+    if(it == m_children.end()) {
+      continue;
+    }
+
+    write_line(it->second, std::to_string(status));
+
+    ::close(it->second);
+    m_children.erase(it);
+  }
+}
+
+void
+zygote_t::on_hangup(pid_t pid) {
+  auto it = m_children.find(pid);
+
+  if(it == m_children.end()) {
+    return;
+  }
+
+  COCAINE_LOG_WARNING(m_log, "zygote has lost the client of pid %d, killing the worker", pid);
+
+  // NOTE: The worker is reaped later on, it's just nobody to report to.
+  ::kill(pid, SIGKILL);
+  ::close(it->second);
+
+  m_children.erase(it);
+}
+
+bool
+cocaine::engine::spawn(const std::string& endpoint,
+                       const std::string& uuid,
+                       int& code)
+{
+  sockaddr_un address;
+
+  if(!make_address(endpoint, address)) {
+    return false;
+  }
+
+  const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  if(fd < 0) {
+    return false;
+  }
+
+  int pid = 0;
+
+  if(::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+     !write_line(fd, uuid) ||
+     !read_number(fd, pid))
+  {
+    ::close(fd);
+    return false;
+  }
+
+  relay_target = pid;
+
+  struct sigaction action;
+
+  std::memset(&action, 0, sizeof(action));
+  action.sa_handler = &relay;
+
+  const int relayed[] = { SIGTERM, SIGINT, SIGQUIT, SIGHUP, SIGUSR2 };
+
+  for(size_t i = 0; i < sizeof(relayed) / sizeof(relayed[0]); ++i) {
+    ::sigaction(relayed[i], &action, nullptr);
+  }
+
+  int status = 0;
+
+  if(!read_number(fd, status)) {
+    // NOTE: The zygote is gone, and the worker is left unattended.
+    ::kill(relay_target, SIGKILL);
+    code = EXIT_FAILURE;
+  } else {
+    code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+  }
+
+  ::close(fd);
+
+  return true;
+}
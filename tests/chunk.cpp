@@ -0,0 +1,143 @@
+#include "chunk.hpp"
+
+#include <boost/test/unit_test.hpp>
+
+#include <limits>
+
+using namespace cocaine;
+using namespace cocaine::engine;
+
+namespace {
+  struct released_t {
+    released_t():
+      count(0),
+      data(nullptr)
+    { }
+
+    size_t count;
+    void * data;
+  };
+
+  void
+  on_release(void * data,
+             void * hint)
+  {
+    released_t * released = static_cast<released_t*>(hint);
+
+    ++released->count;
+    released->data = data;
+  }
+
+  // A payload with the given headroom in front of it.
+  struct buffer_t {
+    buffer_t(size_t headroom_,
+             size_t size_):
+      memory(headroom_ + size_, 'x'),
+      headroom(headroom_),
+      size(size_)
+    { }
+
+    char*
+    data() {
+      return memory.data() + headroom;
+    }
+
+    std::vector<char> memory;
+
+    const size_t headroom,
+                 size;
+  };
+
+  std::string
+  payload(const boost::shared_ptr<zmq::message_t>& frame) {
+    const chunk_t chunk(chunk_t::decode(frame));
+
+    return std::string(chunk.data(), chunk.size());
+  }
+
+  // Packs the buffer, checks the frame and drops it, returning the number of
+  // releases seen while the frame was alive.
+  size_t
+  pack_and_drop(buffer_t& buffer,
+                released_t& released)
+  {
+    boost::shared_ptr<zmq::message_t> frame(boost::make_shared<zmq::message_t>());
+
+    pack_chunk(*frame, buffer.data(), buffer.size, buffer.headroom, &on_release, &released);
+
+    BOOST_CHECK_EQUAL(payload(frame), std::string(buffer.size, 'x'));
+
+    const size_t alive = released.count;
+
+    frame.reset();
+
+    return alive;
+  }
+}
+
+BOOST_AUTO_TEST_SUITE(chunk)
+
+BOOST_AUTO_TEST_CASE(copied) {
+  const std::string data(70000, 'x');
+
+  boost::shared_ptr<zmq::message_t> frame(boost::make_shared<zmq::message_t>());
+
+  pack_chunk(*frame, data.data(), data.size());
+
+  BOOST_CHECK_EQUAL(frame->size(), data.size() + 5);
+  BOOST_CHECK_EQUAL(payload(frame), data);
+}
+
+BOOST_AUTO_TEST_CASE(owned_with_the_control_block_in_the_headroom) {
+  buffer_t buffer(owning_headroom, 1000);
+  released_t released;
+
+  BOOST_CHECK_EQUAL(pack_and_drop(buffer, released), 0);
+  BOOST_CHECK_EQUAL(released.count, 1);
+  BOOST_CHECK_EQUAL(released.data, buffer.data());
+}
+
+BOOST_AUTO_TEST_CASE(owned_with_the_control_block_on_the_heap) {
+  // NOTE: Enough for the header only.
+  buffer_t buffer(3, 1000);
+  released_t released;
+
+  BOOST_CHECK_EQUAL(pack_and_drop(buffer, released), 0);
+  BOOST_CHECK_EQUAL(released.count, 1);
+  BOOST_CHECK_EQUAL(released.data, buffer.data());
+}
+
+BOOST_AUTO_TEST_CASE(owned_without_headroom) {
+  buffer_t buffer(0, 1000);
+  released_t released;
+
+  // NOTE: The payload is copied, and released right away.
+  BOOST_CHECK_EQUAL(pack_and_drop(buffer, released), 1);
+  BOOST_CHECK_EQUAL(released.count, 1);
+  BOOST_CHECK_EQUAL(released.data, buffer.data());
+}
+
+BOOST_AUTO_TEST_CASE(too_large) {
+  char data[owning_headroom + 1] = { 0 };
+  const size_t size = static_cast<size_t>(std::numeric_limits<uint32_t>::max()) + 1;
+
+  zmq::message_t frame;
+
+  BOOST_CHECK_THROW(pack_chunk(frame, data, size), cocaine::error_t);
+
+  // NOTE: The owning variant releases the buffer even though it throws, and
+  // only once, with or without the headroom.
+  for(size_t headroom = 0; headroom <= owning_headroom; headroom += owning_headroom) {
+    released_t released;
+
+    BOOST_CHECK_THROW(
+      pack_chunk(frame, data + headroom, size, headroom, &on_release, &released),
+      cocaine::error_t
+    );
+
+    BOOST_CHECK_EQUAL(released.count, 1);
+    BOOST_CHECK_EQUAL(released.data, data + headroom);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
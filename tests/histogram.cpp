@@ -0,0 +1,98 @@
+#include "metrics.hpp"
+
+#include <boost/test/unit_test.hpp>
+
+#include <cmath>
+
+using namespace cocaine;
+using namespace cocaine::engine;
+
+namespace {
+  // The buckets are 1/16th of a power of two wide, and report their middle.
+  void
+  check_close(uint64_t actual,
+              uint64_t expected)
+  {
+    const double error = std::fabs(static_cast<double>(actual) - expected);
+
+    BOOST_CHECK_MESSAGE(
+      error <= expected / 16.0,
+      "the quantile is " << actual << ", expected about " << expected
+    );
+  }
+}
+
+BOOST_AUTO_TEST_SUITE(histogram)
+
+BOOST_AUTO_TEST_CASE(empty) {
+  histogram_t histogram;
+
+  BOOST_CHECK_EQUAL(histogram.count(), 0);
+  BOOST_CHECK_EQUAL(histogram.quantile(0.5), 0);
+  BOOST_CHECK_EQUAL(histogram.quantile(1.0), 0);
+}
+
+BOOST_AUTO_TEST_CASE(small_values_are_exact) {
+  histogram_t histogram;
+
+  for(uint64_t value = 0; value < 32; ++value) {
+    histogram.record(value);
+  }
+
+  BOOST_CHECK_EQUAL(histogram.count(), 32);
+  BOOST_CHECK_EQUAL(histogram.quantile(0.0), 0);
+  BOOST_CHECK_EQUAL(histogram.quantile(0.5), 15);
+  BOOST_CHECK_EQUAL(histogram.quantile(1.0), 31);
+}
+
+BOOST_AUTO_TEST_CASE(uniform_percentiles) {
+  histogram_t histogram;
+
+  for(uint64_t value = 1; value <= 100000; ++value) {
+    histogram.record(value);
+  }
+
+  check_close(histogram.quantile(0.5), 50000);
+  check_close(histogram.quantile(0.9), 90000);
+  check_close(histogram.quantile(0.99), 99000);
+  check_close(histogram.quantile(0.999), 99900);
+
+  // NOTE: The top bucket is capped by the largest value recorded.
+  BOOST_CHECK_EQUAL(histogram.quantile(1.0), 100000);
+}
+
+BOOST_AUTO_TEST_CASE(skewed_percentiles) {
+  histogram_t histogram;
+
+  // 99% fast requests and a slow tail.
+  for(size_t i = 0; i < 9900; ++i) {
+    histogram.record(100);
+  }
+
+  for(size_t i = 0; i < 100; ++i) {
+    histogram.record(1000000);
+  }
+
+  check_close(histogram.quantile(0.5), 100);
+  check_close(histogram.quantile(0.99), 100);
+  check_close(histogram.quantile(0.995), 1000000);
+
+  const Json::Value snapshot(histogram.snapshot());
+
+  BOOST_CHECK_EQUAL(snapshot["count"].asUInt64(), 10000);
+  BOOST_CHECK_EQUAL(snapshot["max"].asUInt64(), 1000000);
+  BOOST_CHECK_CLOSE(snapshot["mean"].asDouble(), 10099.0, 0.001);
+}
+
+BOOST_AUTO_TEST_CASE(huge_values) {
+  histogram_t histogram;
+
+  // NOTE: Well beyond the range of the buckets, which lump it together with
+  // whatever else is that large.
+  histogram.record(1ULL << 50);
+
+  BOOST_CHECK_EQUAL(histogram.count(), 1);
+  BOOST_CHECK_EQUAL(histogram.quantile(0.5), 1ULL << 50);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
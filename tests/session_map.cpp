@@ -0,0 +1,161 @@
+#include "session_map.hpp"
+
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+
+using namespace cocaine;
+using namespace cocaine::engine;
+
+namespace {
+  typedef session_map_t<size_t> map_t;
+
+  // Erases another session once destroyed, like an upstream which closes
+  // a session of its own on the way out.
+  struct probe_t {
+    typedef session_map_t<boost::shared_ptr<probe_t>> map_type;
+
+    probe_t(map_type& map_,
+            const unique_id_t& other_):
+      map(map_),
+      other(other_)
+    { }
+
+    ~probe_t() {
+      map_type::iterator it(map.find(other));
+
+      if(it != map.end()) {
+        map.erase(it);
+      }
+    }
+
+    map_type& map;
+    const unique_id_t other;
+  };
+}
+
+BOOST_AUTO_TEST_SUITE(session_map)
+
+BOOST_AUTO_TEST_CASE(erase_keeps_the_probe_runs) {
+  // NOTE: A small table, so that it's rehashed a few times and the probe
+  // runs get long enough for the erasure to shift them around.
+  map_t map;
+  std::vector<unique_id_t> keys(2000);
+
+  for(size_t i = 0; i < keys.size(); ++i) {
+    BOOST_REQUIRE(map.emplace(keys[i], i).second);
+  }
+
+  for(size_t i = 0; i < keys.size(); i += 2) {
+    map_t::iterator it(map.find(keys[i]));
+
+    BOOST_REQUIRE(it != map.end());
+    map.erase(it);
+  }
+
+  BOOST_CHECK_EQUAL(map.size(), keys.size() / 2);
+
+  for(size_t i = 0; i < keys.size(); ++i) {
+    map_t::iterator it(map.find(keys[i]));
+
+    if(i % 2) {
+      BOOST_REQUIRE(it != map.end());
+      BOOST_CHECK_EQUAL(it->second, i);
+    } else {
+      BOOST_CHECK(it == map.end());
+    }
+  }
+
+  size_t visited = 0;
+
+  for(map_t::iterator it = map.begin(); it != map.end(); ++it) {
+    BOOST_CHECK(it->second % 2 == 1);
+    ++visited;
+  }
+
+  BOOST_CHECK_EQUAL(visited, map.size());
+}
+
+BOOST_AUTO_TEST_CASE(reinsert_after_erase) {
+  map_t map;
+  std::vector<unique_id_t> keys(500);
+
+  for(size_t i = 0; i < keys.size(); ++i) {
+    map.emplace(keys[i], i);
+  }
+
+  for(size_t i = 0; i < keys.size(); ++i) {
+    map.erase(map.find(keys[i]));
+  }
+
+  BOOST_CHECK(map.empty());
+  BOOST_CHECK(map.begin() == map.end());
+
+  for(size_t i = 0; i < keys.size(); ++i) {
+    BOOST_REQUIRE(map.emplace(keys[i], i + keys.size()).second);
+  }
+
+  BOOST_CHECK_EQUAL(map.size(), keys.size());
+
+  for(size_t i = 0; i < keys.size(); ++i) {
+    map_t::iterator it(map.find(keys[i]));
+
+    BOOST_REQUIRE(it != map.end());
+    BOOST_CHECK_EQUAL(it->second, i + keys.size());
+  }
+
+  // A duplicate is refused and points at the existing value.
+  const std::pair<map_t::iterator, bool> result = map.emplace(keys[0], 0);
+
+  BOOST_CHECK(!result.second);
+  BOOST_CHECK_EQUAL(result.first->second, keys.size());
+}
+
+BOOST_AUTO_TEST_CASE(erased_value_outlives_the_shift) {
+  probe_t::map_type map;
+  std::vector<unique_id_t> keys(2000);
+
+  for(size_t i = 0; i < keys.size(); ++i) {
+    map.emplace(keys[i], boost::shared_ptr<probe_t>());
+  }
+
+  // NOTE: Every session erases another one once destroyed, right from
+  // within its own erasure, which might cascade further.
+  for(size_t i = 0; i < keys.size(); ++i) {
+    map.find(keys[i])->second = boost::make_shared<probe_t>(map, keys[(i * 7 + 3) % keys.size()]);
+  }
+
+  std::vector<char> erased(keys.size(), false);
+
+  for(size_t i = 0; i < keys.size(); i += 5) {
+    probe_t::map_type::iterator it(map.find(keys[i]));
+
+    if(it == map.end()) {
+      continue;
+    }
+
+    map.erase(it);
+
+    // NOTE: Replays the cascade.
+    for(size_t j = i; !erased[j]; j = (j * 7 + 3) % keys.size()) {
+      erased[j] = true;
+    }
+  }
+
+  for(size_t i = 0; i < keys.size(); ++i) {
+    BOOST_CHECK_EQUAL(map.find(keys[i]) == map.end(), static_cast<bool>(erased[i]));
+  }
+
+  BOOST_CHECK_EQUAL(map.size(), static_cast<size_t>(std::count(erased.begin(), erased.end(), false)));
+
+  size_t visited = 0;
+
+  for(probe_t::map_type::iterator it = map.begin(); it != map.end(); ++it) {
+    BOOST_CHECK(it->second);
+    ++visited;
+  }
+
+  BOOST_CHECK_EQUAL(visited, map.size());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
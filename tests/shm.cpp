@@ -0,0 +1,154 @@
+#include "shm.hpp"
+
+#include <boost/test/unit_test.hpp>
+
+#include <cstring>
+
+using namespace cocaine;
+using namespace cocaine::engine;
+
+namespace {
+  // The state and the size of a record, ahead of its data.
+  const size_t header = 8;
+
+  // Eight alignment units, with a record header taking a few bytes of each.
+  struct ring_fixture_t {
+    ring_fixture_t():
+      ring(memory, sizeof(memory))
+    { }
+
+    char*
+    write(size_t size,
+          char fill,
+          uint64_t& offset)
+    {
+      const std::string data(size, fill);
+
+      if(!ring.write(data.data(), data.size(), offset)) {
+        return nullptr;
+      }
+
+      return ring.read(offset, size);
+    }
+
+    alignas(shm_ring_t::alignment) char memory[8 * shm_ring_t::alignment];
+    shm_ring_t ring;
+  };
+
+  bool
+  filled(const char * data,
+         size_t size,
+         char fill)
+  {
+    return std::string(data, size) == std::string(size, fill);
+  }
+}
+
+BOOST_FIXTURE_TEST_SUITE(shm_ring, ring_fixture_t)
+
+BOOST_AUTO_TEST_CASE(round_trip) {
+  uint64_t offset = 0;
+
+  char * data = write(100, 'a', offset);
+
+  BOOST_REQUIRE(data);
+  BOOST_CHECK_EQUAL(offset, 0);
+  BOOST_CHECK(filled(data, 100, 'a'));
+
+  // A descriptor with the wrong size or offset is bogus.
+  BOOST_CHECK(!ring.read(offset, 99));
+  BOOST_CHECK(!ring.read(offset + 1, 100));
+  BOOST_CHECK(!ring.read(shm_ring_t::alignment * 2, 100));
+
+  shm_ring_t::release(data);
+
+  // Released records can't be read anymore.
+  BOOST_CHECK(!ring.read(offset, 100));
+}
+
+BOOST_AUTO_TEST_CASE(full_until_released) {
+  uint64_t offsets[4];
+  char * records[4];
+
+  // NOTE: 100 bytes and the header take two alignment units.
+  for(size_t i = 0; i < 4; ++i) {
+    records[i] = write(100, 'a' + i, offsets[i]);
+    BOOST_REQUIRE(records[i]);
+  }
+
+  uint64_t offset = 0;
+
+  BOOST_CHECK(!write(1, 'x', offset));
+
+  // Released out of order, only the tail is reclaimed.
+  shm_ring_t::release(records[1]);
+  BOOST_CHECK(!write(1, 'x', offset));
+
+  shm_ring_t::release(records[0]);
+  BOOST_REQUIRE(write(100, 'x', offset));
+  BOOST_REQUIRE(write(100, 'y', offset));
+  BOOST_CHECK(!write(1, 'z', offset));
+
+  BOOST_CHECK(filled(records[2], 100, 'c'));
+  BOOST_CHECK(filled(records[3], 100, 'd'));
+}
+
+BOOST_AUTO_TEST_CASE(wraps_around_with_padding) {
+  uint64_t a = 0, b = 0, c = 0, d = 0, e = 0;
+
+  char * first = write(100, 'a', a);
+  char * second = write(100, 'b', b);
+  char * third = write(100, 'c', c);
+
+  BOOST_REQUIRE(first && second && third);
+  BOOST_CHECK_EQUAL(c, 4 * shm_ring_t::alignment);
+
+  shm_ring_t::release(first);
+  shm_ring_t::release(second);
+
+  // NOTE: Three units don't fit into the two left at the end, so those are
+  // padded over and the record goes at the start.
+  char * fourth = write(150, 'd', d);
+
+  BOOST_REQUIRE(fourth);
+  BOOST_CHECK_EQUAL(d, 0);
+  BOOST_CHECK(filled(fourth, 150, 'd'));
+  BOOST_CHECK(filled(third, 100, 'c'));
+
+  // The padding isn't a record anyone can read.
+  BOOST_CHECK(!ring.read(6 * shm_ring_t::alignment, 2 * shm_ring_t::alignment - header));
+
+  // Nothing fits in between, till the padding is reclaimed along with the
+  // record before it.
+  BOOST_CHECK(!write(100, 'x', e));
+
+  shm_ring_t::release(third);
+
+  char * fifth = write(200, 'e', e);
+
+  BOOST_REQUIRE(fifth);
+  BOOST_CHECK_EQUAL(e, 3 * shm_ring_t::alignment);
+  BOOST_CHECK(filled(fifth, 200, 'e'));
+  BOOST_CHECK(filled(fourth, 150, 'd'));
+
+  // Both are reclaimed once released, so that six units fit at the start,
+  // with the last one at the end padded over once again.
+  shm_ring_t::release(fourth);
+  shm_ring_t::release(fifth);
+
+  const size_t size = 6 * shm_ring_t::alignment - header;
+
+  char * sixth = write(size, 'f', a);
+
+  BOOST_REQUIRE(sixth);
+  BOOST_CHECK_EQUAL(a, 0);
+  BOOST_CHECK(filled(sixth, size, 'f'));
+}
+
+BOOST_AUTO_TEST_CASE(too_large) {
+  uint64_t offset = 0;
+
+  BOOST_CHECK(!write(sizeof(memory), 'x', offset));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,104 @@
+#include "wheel.hpp"
+
+#include <boost/test/unit_test.hpp>
+
+#include <map>
+#include <random>
+
+using namespace cocaine;
+using namespace cocaine::engine;
+
+namespace {
+  typedef timer_wheel_t<size_t> wheel_t;
+
+  // Advances the wheel by the given number of ticks, recording the tick
+  // every value has fired at.
+  void
+  run(wheel_t& wheel,
+      uint64_t ticks,
+      std::map<size_t, uint64_t>& fired)
+  {
+    for(uint64_t i = 0; i < ticks; ++i) {
+      wheel.advance([&](size_t value) {
+        BOOST_CHECK(fired.insert(std::make_pair(value, wheel.now())).second);
+      });
+    }
+  }
+}
+
+BOOST_AUTO_TEST_SUITE(wheel)
+
+BOOST_AUTO_TEST_CASE(fires_on_the_deadline) {
+  wheel_t wheel;
+  std::map<size_t, uint64_t> fired;
+
+  // NOTE: The delays straddle the level boundaries, including the span of
+  // the whole wheel and beyond.
+  const uint64_t delays[] = {
+    0, 1, 2, 63, 64, 65, 127, 128, 4095, 4096, 4097, 262143, 262144, 262145,
+    16777215, 16777216, 16777217, 20000000
+  };
+
+  const size_t count = sizeof(delays) / sizeof(delays[0]);
+
+  for(size_t i = 0; i < count; ++i) {
+    wheel.schedule(delays[i], i);
+  }
+
+  BOOST_CHECK_EQUAL(wheel.size(), count);
+
+  run(wheel, 20000000, fired);
+
+  BOOST_CHECK(wheel.empty());
+  BOOST_REQUIRE_EQUAL(fired.size(), count);
+
+  for(size_t i = 0; i < count; ++i) {
+    BOOST_CHECK_EQUAL(fired[i], std::max<uint64_t>(delays[i], 1));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(fires_in_deadline_order) {
+  wheel_t wheel;
+  std::map<size_t, uint64_t> fired;
+  std::map<size_t, uint64_t> deadlines;
+
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<uint64_t> delay(1, 10000);
+
+  // NOTE: Values are scheduled while the wheel is moving, so that they land
+  // at every offset within the slots of the upper levels.
+  for(size_t i = 0; i < 5000; ++i) {
+    const uint64_t next = delay(generator);
+
+    deadlines[i] = wheel.now() + next;
+    wheel.schedule(next, i);
+
+    run(wheel, i % 3, fired);
+  }
+
+  run(wheel, 10000, fired);
+
+  BOOST_CHECK(wheel.empty());
+  BOOST_REQUIRE_EQUAL(fired.size(), deadlines.size());
+
+  for(auto it = deadlines.begin(); it != deadlines.end(); ++it) {
+    BOOST_CHECK_EQUAL(fired[it->first], it->second);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(skips_while_empty) {
+  wheel_t wheel;
+  std::map<size_t, uint64_t> fired;
+
+  wheel.skip(1000);
+
+  BOOST_CHECK_EQUAL(wheel.now(), 1000);
+
+  wheel.schedule(100, 0);
+  run(wheel, 100, fired);
+
+  BOOST_REQUIRE_EQUAL(fired.size(), 1);
+  BOOST_CHECK_EQUAL(fired[0], 1100);
+}
+
+BOOST_AUTO_TEST_SUITE_END()